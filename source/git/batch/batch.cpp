@@ -0,0 +1,353 @@
+#include "batch.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define GIT_BATCH_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <cstring>
+#endif
+
+namespace Git::Batch
+{
+static bool WritePlain(const File &Pending)
+{
+#ifndef _WIN32
+    // Opened like the ring opens it, so either way the file gets 0666 or 0777 less the umask.
+    int Handle = open(Pending.Path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, Pending.Executable ? 0777 : 0666);
+
+    if (Handle < 0)
+        return false;
+
+    const char *Data = Pending.Content.data();
+    size_t Left = Pending.Content.size();
+
+    while (Left > 0)
+    {
+        ssize_t Count = write(Handle, Data, Left);
+
+        if (Count < 0 && errno == EINTR)
+            continue;
+
+        if (Count <= 0)
+            break;
+
+        Data += Count;
+        Left -= (size_t)Count;
+    }
+
+    return close(Handle) == 0 && Left == 0;
+#else
+    std::error_code ErrorCode;
+
+    {
+        std::ofstream Stream(Pending.Path, std::ios::binary | std::ios::trunc);
+
+        Stream.write(Pending.Content.data(), (std::streamsize)Pending.Content.size());
+
+        if (!Stream.good())
+            return false;
+    }
+
+    if (Pending.Executable)
+        std::filesystem::permissions(Pending.Path,
+                                     std::filesystem::perms::owner_exec | std::filesystem::perms::group_exec |
+                                         std::filesystem::perms::others_exec,
+                                     std::filesystem::perm_options::add, ErrorCode);
+
+    return !ErrorCode;
+#endif
+}
+
+#ifdef GIT_BATCH_URING
+// Cleared after the first failed setup, e.g. when a seccomp profile or kernel.io_uring_disabled blocks it, and when
+// the kernel rejects one of the operations as unknown.
+static std::atomic<bool> Supported{true};
+// Enough for every staging thread of a couple of concurrent updates.
+constexpr size_t MAX_IDLE_RINGS = 16;
+
+class Ring
+{
+  public:
+    Ring()
+    {
+        io_uring_params Params{};
+
+        Fd = (int)syscall(__NR_io_uring_setup, (unsigned)(QUEUE_DEPTH * 2), &Params);
+
+        if (Fd < 0)
+            return;
+
+        SqSize = Params.sq_off.array + Params.sq_entries * sizeof(unsigned);
+        CqSize = Params.cq_off.cqes + Params.cq_entries * sizeof(io_uring_cqe);
+
+        if (Params.features & IORING_FEAT_SINGLE_MMAP)
+            SqSize = CqSize = std::max(SqSize, CqSize);
+
+        SqRing = mmap(nullptr, SqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Fd, IORING_OFF_SQ_RING);
+        CqRing = (Params.features & IORING_FEAT_SINGLE_MMAP)
+                     ? SqRing
+                     : mmap(nullptr, CqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Fd, IORING_OFF_CQ_RING);
+        SqesSize = Params.sq_entries * sizeof(io_uring_sqe);
+        Sqes = (io_uring_sqe *)mmap(nullptr, SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Fd,
+                                    IORING_OFF_SQES);
+
+        if (SqRing == MAP_FAILED || CqRing == MAP_FAILED || Sqes == (io_uring_sqe *)MAP_FAILED)
+            return;
+
+        char *Sq = (char *)SqRing, *Cq = (char *)CqRing;
+
+        SqTail = (unsigned *)(Sq + Params.sq_off.tail);
+        SqMask = *(unsigned *)(Sq + Params.sq_off.ring_mask);
+        SqArray = (unsigned *)(Sq + Params.sq_off.array);
+        CqHead = (unsigned *)(Cq + Params.cq_off.head);
+        CqTail = (unsigned *)(Cq + Params.cq_off.tail);
+        CqMask = *(unsigned *)(Cq + Params.cq_off.ring_mask);
+        Cqes = (io_uring_cqe *)(Cq + Params.cq_off.cqes);
+        Ready = true;
+    }
+
+    ~Ring()
+    {
+        if (Sqes && Sqes != (io_uring_sqe *)MAP_FAILED)
+            munmap(Sqes, SqesSize);
+
+        if (CqRing && CqRing != MAP_FAILED && CqRing != SqRing)
+            munmap(CqRing, CqSize);
+
+        if (SqRing && SqRing != MAP_FAILED)
+            munmap(SqRing, SqSize);
+
+        if (Fd >= 0)
+            close(Fd);
+    }
+
+    bool IsReady() const
+    {
+        return Ready;
+    }
+
+    io_uring_sqe *Next(uint8_t Opcode, uint64_t UserData)
+    {
+        unsigned Tail = *SqTail + Queued;
+        io_uring_sqe *Entry = &Sqes[Tail & SqMask];
+
+        memset(Entry, 0, sizeof(*Entry));
+        Entry->opcode = Opcode;
+        Entry->user_data = UserData;
+        SqArray[Tail & SqMask] = Tail & SqMask;
+        Queued++;
+
+        return Entry;
+    }
+
+    // Submits everything queued and waits for all of it, then hands each completion to Reap. On a failure only what
+    // the kernel already took is waited for, so every completion is still handed out and the caller can close what
+    // was opened. Settled tells whether that wait finished.
+    template <typename Callback> bool Submit(Callback &&Reap)
+    {
+        unsigned Count = Queued, Unsubmitted = Queued;
+        bool Failed = false;
+
+        __atomic_store_n(SqTail, *SqTail + Queued, __ATOMIC_RELEASE);
+        Queued = 0;
+        Settled = false;
+
+        for (unsigned Done = 0; Done < Count;)
+        {
+            long Result = syscall(__NR_io_uring_enter, Fd, Unsubmitted, Count - Done, IORING_ENTER_GETEVENTS,
+                                  nullptr, 0);
+
+            if (Result > 0)
+                Unsubmitted -= std::min(Unsubmitted, (unsigned)Result);
+            else if (Result < 0 && errno != EINTR)
+            {
+                if (Failed)
+                    return false;
+
+                Failed = true;
+                Count -= Unsubmitted;
+                Unsubmitted = 0;
+            }
+
+            unsigned Head = *CqHead;
+
+            for (; Head != __atomic_load_n(CqTail, __ATOMIC_ACQUIRE); ++Head, ++Done)
+                Reap(Cqes[Head & CqMask]);
+
+            __atomic_store_n(CqHead, Head, __ATOMIC_RELEASE);
+        }
+
+        Settled = true;
+
+        return !Failed;
+    }
+
+    bool IsSettled() const
+    {
+        return Settled;
+    }
+
+  private:
+    int Fd = -1;
+    bool Ready = false;
+    bool Settled = true;
+    unsigned Queued = 0;
+    void *SqRing = nullptr, *CqRing = nullptr;
+    io_uring_sqe *Sqes = nullptr;
+    size_t SqSize = 0, CqSize = 0, SqesSize = 0;
+    unsigned *SqTail = nullptr, *SqArray = nullptr, *CqHead = nullptr, *CqTail = nullptr;
+    unsigned SqMask = 0, CqMask = 0;
+    io_uring_cqe *Cqes = nullptr;
+};
+
+// Opens one chunk in a single submission, then writes and closes it in a second one. Each write is linked to its
+// close. Files that did not make it through are marked in Retry.
+static bool WriteChunk(Ring &Queue, const std::vector<File> &Files, size_t First, size_t Count,
+                       std::vector<bool> &Retry)
+{
+    std::vector<int> Handles(Count, -1);
+    // Positive until the close completes, a close never returns that.
+    std::vector<int> Closed(Count, 1);
+
+    for (size_t Index = 0; Index < Count; ++Index)
+    {
+        io_uring_sqe *Entry = Queue.Next(IORING_OP_OPENAT, Index);
+
+        Entry->fd = AT_FDCWD;
+        Entry->addr = (uint64_t)(uintptr_t)Files[First + Index].Path.c_str();
+        Entry->len = Files[First + Index].Executable ? 0777 : 0666;
+        Entry->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    }
+
+    bool Opened = Queue.Submit([&](const io_uring_cqe &Done) { Handles[Done.user_data] = Done.res; });
+
+    // Kernels before 5.6 know io_uring but not these operations.
+    if (std::count(Handles.begin(), Handles.end(), -EINVAL) > 0)
+        Supported = false;
+
+    if (!Opened || !Supported)
+    {
+        for (int Handle : Handles)
+            if (Handle >= 0)
+                close(Handle);
+
+        return false;
+    }
+
+    std::vector<bool> Written(Count, false);
+
+    for (size_t Index = 0; Index < Count; ++Index)
+    {
+        if (Handles[Index] < 0)
+            continue;
+
+        const std::string &Content = Files[First + Index].Content;
+        io_uring_sqe *Entry = Queue.Next(IORING_OP_WRITE, Index * 2);
+
+        Entry->fd = Handles[Index];
+        Entry->addr = (uint64_t)(uintptr_t)Content.data();
+        Entry->len = (uint32_t)Content.size();
+        Entry->flags = IOSQE_IO_LINK;
+
+        Queue.Next(IORING_OP_CLOSE, Index * 2 + 1)->fd = Handles[Index];
+    }
+
+    bool Submitted = Queue.Submit([&](const io_uring_cqe &Done) {
+        size_t Index = Done.user_data / 2;
+
+        if (Done.res == -EINVAL)
+            Supported = false;
+
+        if (Done.user_data % 2)
+            Closed[Index] = Done.res;
+        else
+            Written[Index] = Done.res >= 0 && (size_t)Done.res == Files[First + Index].Content.size();
+    });
+
+    for (size_t Index = 0; Index < Count; ++Index)
+    {
+        // A short or failed write cancels the linked close, a kernel without the close operation rejects it, and a
+        // failed submission may never have sent it. A close that may still be in flight is left alone rather than
+        // risk closing a reused handle.
+        bool Open = Closed[Index] == 1 || Closed[Index] == -ECANCELED || Closed[Index] == -EINVAL;
+
+        if (Handles[Index] >= 0 && Queue.IsSettled() && Open)
+            close(Handles[Index]);
+
+        Retry[First + Index] = Handles[Index] < 0 || !Submitted || !Written[Index] || Closed[Index] != 0;
+    }
+
+    return Submitted;
+}
+
+// Rings outlive the batches and threads that use them, setting one up costs more than a batch saves.
+static std::mutex RingMutex;
+static std::vector<std::unique_ptr<Ring>> Rings;
+
+static std::unique_ptr<Ring> Acquire()
+{
+    {
+        std::lock_guard<std::mutex> Lock(RingMutex);
+
+        if (!Rings.empty())
+        {
+            std::unique_ptr<Ring> Queue = std::move(Rings.back());
+            Rings.pop_back();
+
+            return Queue;
+        }
+    }
+
+    return std::make_unique<Ring>();
+}
+
+static void Release(std::unique_ptr<Ring> Queue)
+{
+    std::lock_guard<std::mutex> Lock(RingMutex);
+
+    if (Rings.size() < MAX_IDLE_RINGS)
+        Rings.push_back(std::move(Queue));
+}
+#endif
+
+bool Write(const std::vector<File> &Files)
+{
+    std::vector<bool> Retry(Files.size(), true);
+
+#ifdef GIT_BATCH_URING
+    // Ring writes take a 32 bit length, and large or single files gain nothing from batching anyway.
+    bool Small = std::all_of(Files.begin(), Files.end(),
+                             [](const File &Pending) { return Pending.Content.size() < (1u << 30); });
+
+    if (Supported && Small && Files.size() > 1)
+    {
+        std::unique_ptr<Ring> Queue = Acquire();
+
+        if (!Queue->IsReady())
+            Supported = false;
+
+        bool Submitted = true;
+
+        for (size_t First = 0; Supported && Submitted && First < Files.size(); First += QUEUE_DEPTH)
+            Submitted = WriteChunk(*Queue, Files, First, std::min(QUEUE_DEPTH, Files.size() - First), Retry);
+
+        // A failed submission leaves the ring in an unknown state, it is dropped instead of going back to the set.
+        if (Supported && Submitted)
+            Release(std::move(Queue));
+    }
+#endif
+
+    for (size_t Index = 0; Index < Files.size(); ++Index)
+        if (Retry[Index] && !WritePlain(Files[Index]))
+            return false;
+
+    return true;
+}
+} // namespace Git::Batch
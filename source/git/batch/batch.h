@@ -0,0 +1,22 @@
+#pragma once
+#include "../includes.h"
+
+// Writes many small files at once. On Linux the opens, writes and closes are queued on an io_uring, so a whole batch
+// costs a few syscalls instead of several per file. Kernels without io_uring, or where it is disabled, get the plain
+// per file path.
+namespace Git::Batch
+{
+// Files per submission, the ring holds a write and a close for each of them.
+constexpr size_t QUEUE_DEPTH = 64;
+
+struct File
+{
+    std::string Path;
+    std::string Content;
+    bool Executable = false;
+};
+
+// Creates or truncates every file with its content. Files the ring could not write are retried the plain way, so
+// false means a file could not be written at all.
+bool Write(const std::vector<File> &Files);
+} // namespace Git::Batch
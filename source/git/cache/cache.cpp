@@ -0,0 +1,177 @@
+#include "cache.h"
+#include "../core/core.h"
+#include "../promisor/promisor.h"
+
+namespace Git::Cache
+{
+struct Entry
+{
+    git_repository *Repository = nullptr;
+    bool Leased = false;
+    bool Stale = false;
+    std::list<std::string>::iterator Recent;
+};
+
+static std::mutex Mutex;
+static std::condition_variable Condition;
+static std::map<std::string, Entry> Entries;
+static std::list<std::string> RecentlyUsed;
+static size_t MaxEntries = 32;
+
+static void Erase(std::map<std::string, Entry>::iterator Iterator)
+{
+    git_repository_free(Iterator->second.Repository);
+    RecentlyUsed.erase(Iterator->second.Recent);
+    Entries.erase(Iterator);
+}
+
+static void Evict()
+{
+    auto Candidate = RecentlyUsed.end();
+
+    while (Entries.size() > MaxEntries && Candidate != RecentlyUsed.begin())
+    {
+        --Candidate;
+        auto Iterator = Entries.find(*Candidate);
+
+        if (Iterator->second.Leased)
+            continue;
+
+        git_repository_free(Iterator->second.Repository);
+        Candidate = RecentlyUsed.erase(Candidate);
+        Entries.erase(Iterator);
+    }
+}
+
+void Initialize(size_t Capacity)
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+    MaxEntries = std::max<size_t>(Capacity, 1);
+}
+
+void Shutdown()
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+
+    for (auto &[Key, CachedEntry] : Entries)
+        git_repository_free(CachedEntry.Repository);
+
+    Entries.clear();
+    RecentlyUsed.clear();
+}
+
+git_repository *Acquire(const std::string &Path)
+{
+    std::string Key = Core::PathKey(Path);
+    std::unique_lock<std::mutex> Lock(Mutex);
+
+    while (true)
+    {
+        auto Iterator = Entries.find(Key);
+
+        if (Iterator == Entries.end())
+            break;
+
+        Entry &CachedEntry = Iterator->second;
+
+        if (!CachedEntry.Leased)
+        {
+            CachedEntry.Leased = true;
+            RecentlyUsed.splice(RecentlyUsed.begin(), RecentlyUsed, CachedEntry.Recent);
+
+            return CachedEntry.Repository;
+        }
+
+        if (Core::IsMainThread())
+            return nullptr;
+
+        Condition.wait(Lock);
+    }
+
+    // Reserve the slot so concurrent callers wait for this open instead of racing it.
+    RecentlyUsed.push_front(Key);
+    Entry &Reserved = Entries[Key];
+    Reserved.Leased = true;
+    Reserved.Recent = RecentlyUsed.begin();
+
+    Lock.unlock();
+
+    git_repository *Repository = nullptr;
+    int Error = git_repository_open(&Repository, Path.c_str());
+
+    if (Error == 0)
+        Promisor::Attach(Repository);
+
+    Lock.lock();
+
+    auto Iterator = Entries.find(Key);
+
+    if (Error != 0)
+    {
+        git_repository_free(Repository);
+        Iterator->second.Repository = nullptr;
+        Erase(Iterator);
+        Condition.notify_all();
+
+        return nullptr;
+    }
+
+    Iterator->second.Repository = Repository;
+
+    return Repository;
+}
+
+void Release(const std::string &Path, git_repository *Repository)
+{
+    std::string Key = Core::PathKey(Path);
+
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        auto Iterator = Entries.find(Key);
+
+        if (Iterator == Entries.end() || Iterator->second.Repository != Repository)
+        {
+            git_repository_free(Repository);
+            return;
+        }
+
+        Iterator->second.Leased = false;
+
+        if (Iterator->second.Stale)
+            Erase(Iterator);
+
+        Evict();
+    }
+
+    Condition.notify_all();
+}
+
+void Invalidate(const std::string &Path)
+{
+    std::string Key = Core::PathKey(Path);
+    std::lock_guard<std::mutex> Lock(Mutex);
+    auto Iterator = Entries.find(Key);
+
+    if (Iterator == Entries.end())
+        return;
+
+    if (Iterator->second.Leased)
+        Iterator->second.Stale = true;
+    else
+        Erase(Iterator);
+}
+
+void SetCapacity(size_t Capacity)
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+
+    MaxEntries = std::max<size_t>(Capacity, 1);
+    Evict();
+}
+
+size_t GetSize()
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+    return Entries.size();
+}
+} // namespace Git::Cache
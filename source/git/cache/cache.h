@@ -0,0 +1,17 @@
+#pragma once
+#include "../includes.h"
+
+// Cached handles are leased to one thread at a time, since a git_repository is not safe to share between threads.
+// Workers block until a lease is free; the main thread never blocks and gets nullptr instead.
+namespace Git::Cache
+{
+void Initialize(size_t Capacity);
+void Shutdown();
+
+git_repository *Acquire(const std::string &Path);
+void Release(const std::string &Path, git_repository *Repository);
+void Invalidate(const std::string &Path);
+
+void SetCapacity(size_t Capacity);
+size_t GetSize();
+} // namespace Git::Cache
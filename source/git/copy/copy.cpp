@@ -0,0 +1,253 @@
+#include "copy.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+#endif
+
+namespace Git::Copy
+{
+// Copy threads per tree.
+constexpr size_t MAX_COPY_WORKERS = 8;
+// Trees with fewer files than this per thread are not worth spreading out.
+constexpr size_t COPY_BATCH = 256;
+
+#ifdef __linux__
+// Returns false without having written anything useful when neither a reflink nor copy_file_range works here.
+static bool KernelCopy(const std::filesystem::path &From, const std::filesystem::path &To)
+{
+    struct stat Info;
+    int Input = open(From.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (Input < 0)
+        return false;
+
+    if (fstat(Input, &Info) != 0)
+    {
+        close(Input);
+        return false;
+    }
+
+    int Output = open(To.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, Info.st_mode & 07777);
+
+    if (Output < 0)
+    {
+        close(Input);
+        return false;
+    }
+
+    bool Copied = ioctl(Output, FICLONE, Input) == 0;
+    off_t Left = Info.st_size;
+
+    while (!Copied && Left > 0)
+    {
+        ssize_t Written = copy_file_range(Input, nullptr, Output, nullptr, (size_t)Left, 0);
+
+        if (Written <= 0)
+            break;
+
+        Left -= Written;
+    }
+
+    Copied = Copied || Left == 0;
+
+    if (Copied)
+    {
+        struct timespec Times[2] = {Info.st_atim, Info.st_mtim};
+
+        fchmod(Output, Info.st_mode & 07777);
+        futimens(Output, Times);
+    }
+
+    close(Output);
+    close(Input);
+
+    return Copied;
+}
+#endif
+
+bool File(const std::filesystem::path &From, const std::filesystem::path &To)
+{
+    std::error_code ErrorCode;
+
+    if (std::filesystem::is_symlink(std::filesystem::symlink_status(From, ErrorCode)))
+    {
+        std::filesystem::remove(To, ErrorCode);
+        std::filesystem::copy_symlink(From, To, ErrorCode);
+
+        return !ErrorCode;
+    }
+
+#ifdef __linux__
+    if (KernelCopy(From, To))
+        return true;
+#endif
+
+    std::filesystem::copy_file(From, To, std::filesystem::copy_options::overwrite_existing, ErrorCode);
+
+    if (ErrorCode)
+        return false;
+
+    std::filesystem::last_write_time(To, std::filesystem::last_write_time(From, ErrorCode), ErrorCode);
+
+    return true;
+}
+
+bool Tree(const std::filesystem::path &Source, const std::filesystem::path &Destination,
+          const std::set<std::string> &Skip, bool HardLink)
+{
+    std::error_code ErrorCode;
+    std::vector<std::filesystem::path> Directories;
+    std::vector<std::filesystem::path> Files;
+
+    std::filesystem::recursive_directory_iterator Iterator(Source, ErrorCode), End;
+
+    // One walk collects everything, so each directory is created once instead of once per file below it.
+    for (; !ErrorCode && Iterator != End; Iterator.increment(ErrorCode))
+    {
+        const std::filesystem::directory_entry &Entry = *Iterator;
+        std::filesystem::path Relative = Entry.path().lexically_relative(Source);
+        bool Directory = !Entry.is_symlink(ErrorCode) && Entry.is_directory(ErrorCode);
+
+        if (Skip.count(Relative.generic_string()))
+        {
+            if (Directory)
+                Iterator.disable_recursion_pending();
+
+            continue;
+        }
+
+        if (Directory)
+            Directories.push_back(std::move(Relative));
+        else
+            Files.push_back(std::move(Relative));
+    }
+
+    if (ErrorCode)
+        return false;
+
+    std::filesystem::create_directories(Destination, ErrorCode);
+
+    // The walk is pre-order, so every parent comes before its children.
+    for (const std::filesystem::path &Directory : Directories)
+        std::filesystem::create_directory(Destination / Directory, ErrorCode);
+
+    size_t Workers = std::min({(size_t)std::max(std::thread::hardware_concurrency(), 1u), MAX_COPY_WORKERS,
+                               Files.size() / COPY_BATCH + 1});
+    std::atomic<size_t> Next{0};
+    std::atomic<bool> Failed{false};
+
+    auto Work = [&]() {
+        for (size_t Job = Next++; Job < Files.size() && !Failed; Job = Next++)
+        {
+            std::filesystem::path From = Source / Files[Job];
+            std::filesystem::path To = Destination / Files[Job];
+            std::error_code LinkError;
+
+            if (HardLink && !std::filesystem::is_symlink(std::filesystem::symlink_status(From, LinkError)))
+            {
+                std::filesystem::remove(To, LinkError);
+                std::filesystem::create_hard_link(From, To, LinkError);
+
+                if (!LinkError)
+                    continue;
+            }
+
+            if (!File(From, To))
+                Failed = true;
+        }
+    };
+
+    std::vector<std::thread> Threads;
+
+    for (size_t Index = 1; Index < Workers; ++Index)
+        Threads.emplace_back(Work);
+
+    Work();
+
+    for (std::thread &Thread : Threads)
+        Thread.join();
+
+    return !Failed;
+}
+
+// The copy Tree replaced: one walk, one relative path, create_directories and copy_file per entry.
+static bool Serial(const std::filesystem::path &Source, const std::filesystem::path &Destination)
+{
+    std::error_code ErrorCode;
+
+    for (std::filesystem::recursive_directory_iterator Iterator(Source, ErrorCode), End;
+         !ErrorCode && Iterator != End; Iterator.increment(ErrorCode))
+    {
+        std::filesystem::path To = Destination / std::filesystem::relative(Iterator->path(), Source, ErrorCode);
+        std::error_code EntryError;
+
+        if (Iterator->is_directory(EntryError))
+        {
+            std::filesystem::create_directories(To, EntryError);
+            continue;
+        }
+
+        std::filesystem::create_directories(To.parent_path(), EntryError);
+        std::filesystem::copy_file(Iterator->path(), To,
+                                   std::filesystem::copy_options::overwrite_existing |
+                                       std::filesystem::copy_options::copy_symlinks,
+                                   EntryError);
+
+        if (EntryError)
+            return false;
+    }
+
+    return !ErrorCode;
+}
+
+bool Measure(const std::filesystem::path &Source, const std::filesystem::path &Destination, bool HardLink,
+             Measurement &Result)
+{
+    std::error_code ErrorCode;
+
+    Result = Measurement();
+
+    if (std::filesystem::exists(std::filesystem::symlink_status(Destination, ErrorCode)))
+        return false;
+
+    for (std::filesystem::recursive_directory_iterator Iterator(Source, ErrorCode), End;
+         !ErrorCode && Iterator != End; Iterator.increment(ErrorCode))
+    {
+        std::error_code EntryError;
+
+        if (Iterator->is_regular_file(EntryError) && !Iterator->is_symlink(EntryError))
+        {
+            Result.Files++;
+            Result.Bytes += Iterator->file_size(EntryError);
+        }
+    }
+
+    if (ErrorCode)
+        return false;
+
+    // The baseline goes first and leaves the source in the page cache for Tree, a second call compares both warm.
+    std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now();
+    bool Copied = Serial(Source, Destination);
+    Result.SerialSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+
+    std::filesystem::remove_all(Destination, ErrorCode);
+
+    if (!Copied)
+        return false;
+
+    Start = std::chrono::steady_clock::now();
+    Copied = Tree(Source, Destination, {}, HardLink);
+    Result.Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+
+    std::filesystem::remove_all(Destination, ErrorCode);
+
+    return Copied;
+}
+} // namespace Git::Copy
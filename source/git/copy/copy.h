@@ -0,0 +1,27 @@
+#pragma once
+#include "../includes.h"
+
+// Copies files and whole trees for the staged writes and atomic deployments.
+namespace Git::Copy
+{
+// Copies one file or symlink over To. On Linux the data is shared with a reflink where the filesystem supports it,
+// otherwise moved in the kernel with copy_file_range. The modification time is carried over.
+bool File(const std::filesystem::path &From, const std::filesystem::path &To);
+// Recreates Source in Destination, skipping the relative paths in Skip. Directories are created up front, the files
+// are spread over a few threads. With HardLink set files are linked instead of copied where the filesystem allows it.
+bool Tree(const std::filesystem::path &Source, const std::filesystem::path &Destination,
+          const std::set<std::string> &Skip, bool HardLink);
+struct Measurement
+{
+    // Seconds taken by Tree and by the serial copy it replaced.
+    double Seconds = 0;
+    double SerialSeconds = 0;
+    size_t Files = 0;
+    uintmax_t Bytes = 0;
+};
+
+// Times a Tree call from Source into Destination against a serial walk with a create_directories and copy_file per
+// entry, the way trees were copied before. Destination must not exist yet and is removed after each copy.
+bool Measure(const std::filesystem::path &Source, const std::filesystem::path &Destination, bool HardLink,
+             Measurement &Result);
+} // namespace Git::Copy
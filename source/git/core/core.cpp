@@ -1,5 +1,14 @@
 #include "core.h"
 #include "../functions/functions.h"
+#include "../pool/pool.h"
+#include "../dispatcher/dispatcher.h"
+#include "../operation/operation.h"
+#include "../watchdog/watchdog.h"
+#include "../cache/cache.h"
+#include "../snapshot/snapshot.h"
+#include "../watcher/watcher.h"
+#include "../updater/updater.h"
+#include "../webhook/webhook.h"
 
 #if defined GIT_32_SERVER
 IFileSystem *g_pFullFileSystem = nullptr;
@@ -7,8 +16,12 @@ IFileSystem *g_pFullFileSystem = nullptr;
 
 namespace Git::Core
 {
+static std::thread::id MainThread;
+
 void Initialize(GarrysMod::Lua::ILuaBase *LUA)
 {
+    MainThread = std::this_thread::get_id();
+
     g_pFullFileSystem = InterfacePointers::Internal::Server::FileSystem();
 
     if (!g_pFullFileSystem)
@@ -20,6 +33,18 @@ void Initialize(GarrysMod::Lua::ILuaBase *LUA)
     Logger::Log(Logger::Success("gmsv_git loaded."));
     Logger::Log(Logger::Info("Version: {green}" GIT_VERSION));
     git_libgit2_init();
+
+    // Lets partial clones made by the git CLI open, their missing objects are fetched by Promisor.
+    const char *Extensions[] = {"partialclone"};
+    git_libgit2_opts(GIT_OPT_SET_EXTENSIONS, Extensions, (size_t)1);
+
+    Cache::Initialize(32);
+    Watchdog::Initialize();
+    Pool::Initialize(Pool::GetDefaultWorkerCount());
+    Watcher::Initialize(Functions::OnRefsChanged);
+    Updater::Initialize();
+    Dispatcher::Initialize(LUA);
+    Operation::Initialize(LUA);
     LUA->CreateTable();
     {
         LUA->PushCFunction(Functions::Clone);
@@ -31,6 +56,18 @@ void Initialize(GarrysMod::Lua::ILuaBase *LUA)
         LUA->PushCFunction(Functions::Checkout);
         LUA->SetField(-2, "Checkout");
 
+        LUA->PushCFunction(Functions::Prepare);
+        LUA->SetField(-2, "Prepare");
+
+        LUA->PushCFunction(Functions::Apply);
+        LUA->SetField(-2, "Apply");
+
+        LUA->PushCFunction(Functions::Rollback);
+        LUA->SetField(-2, "Rollback");
+
+        LUA->PushCFunction(Functions::GetHistory);
+        LUA->SetField(-2, "GetHistory");
+
         LUA->PushCFunction(Functions::Add);
         LUA->SetField(-2, "Add");
 
@@ -42,6 +79,70 @@ void Initialize(GarrysMod::Lua::ILuaBase *LUA)
 
         LUA->PushCFunction(Functions::GetBranch);
         LUA->SetField(-2, "GetBranch");
+
+        LUA->PushCFunction(Functions::GetShortHash);
+        LUA->SetField(-2, "GetShortHash");
+
+        LUA->PushCFunction(Functions::Describe);
+        LUA->SetField(-2, "Describe");
+
+        LUA->PushCFunction(Functions::DescribeAsync);
+        LUA->SetField(-2, "DescribeAsync");
+
+        LUA->PushCFunction(Functions::CheckRemote);
+        LUA->SetField(-2, "CheckRemote");
+
+        LUA->PushCFunction(Functions::Deepen);
+        LUA->SetField(-2, "Deepen");
+
+        LUA->PushCFunction(Functions::SetAtomic);
+        LUA->SetField(-2, "SetAtomic");
+
+        LUA->PushCFunction(Functions::SetBlobStore);
+        LUA->SetField(-2, "SetBlobStore");
+
+        LUA->PushCFunction(Functions::PruneBlobStore);
+        LUA->SetField(-2, "PruneBlobStore");
+
+        LUA->PushCFunction(Functions::MeasureCopy);
+        LUA->SetField(-2, "MeasureCopy");
+
+        LUA->PushCFunction(Functions::AutoUpdate);
+        LUA->SetField(-2, "AutoUpdate");
+
+        LUA->PushCFunction(Functions::StopAutoUpdate);
+        LUA->SetField(-2, "StopAutoUpdate");
+
+        LUA->PushCFunction(Functions::StartWebhook);
+        LUA->SetField(-2, "StartWebhook");
+
+        LUA->PushCFunction(Functions::StopWebhook);
+        LUA->SetField(-2, "StopWebhook");
+
+        LUA->PushCFunction(Functions::SetCallbackBudget);
+        LUA->SetField(-2, "SetCallbackBudget");
+
+        LUA->CreateTable();
+
+        for (int Code = 0; GitCodeName((GitCodes)Code); ++Code)
+        {
+            LUA->PushNumber(Code);
+            LUA->SetField(-2, GitCodeName((GitCodes)Code));
+        }
+
+        LUA->SetField(-2, "Codes");
+
+        LUA->PushCFunction(Functions::SetTimeouts);
+        LUA->SetField(-2, "SetTimeouts");
+
+        LUA->PushCFunction(Functions::SetRepositoryCacheSize);
+        LUA->SetField(-2, "SetRepositoryCacheSize");
+
+        LUA->PushCFunction(Functions::SetWorkerCount);
+        LUA->SetField(-2, "SetWorkerCount");
+
+        LUA->PushCFunction(Functions::GetPoolStats);
+        LUA->SetField(-2, "GetPoolStats");
     }
     LUA->SetField(GarrysMod::Lua::INDEX_GLOBAL, "git");
 }
@@ -49,6 +150,14 @@ void Initialize(GarrysMod::Lua::ILuaBase *LUA)
 void Shutdown(GarrysMod::Lua::ILuaBase *LUA)
 {
     Logger::Log(Logger::Info("Shutting down Git..."));
+    Webhook::Stop();
+    Watcher::Shutdown();
+    Updater::Shutdown();
+    Pool::Shutdown();
+    Watchdog::Shutdown();
+    Cache::Shutdown();
+    Snapshot::Shutdown();
+    Dispatcher::Shutdown(LUA);
     git_libgit2_shutdown();
     LUA->PushNil();
     LUA->SetField(GarrysMod::Lua::INDEX_GLOBAL, "git");
@@ -63,4 +172,78 @@ std::string RelativePathToFullPath(const std::string &RelativePath)
 
     return std::string(RootFilePath) + RelativePath;
 }
-} // namespace Git::Core
\ No newline at end of file
+
+std::string FullPathToRelativePath(const std::string &FullPath)
+{
+    std::string Root = RelativePathToFullPath(std::string());
+
+    if (!Root.empty() && FullPath.compare(0, Root.size(), Root) == 0)
+        return FullPath.substr(Root.size());
+
+    return FullPath;
+}
+
+std::string PathKey(const std::string &Path)
+{
+    std::string Key = std::filesystem::path(Path).lexically_normal().generic_string();
+
+    while (Key.size() > 1 && Key.back() == '/')
+        Key.pop_back();
+
+#ifdef _WIN32
+    std::transform(Key.begin(), Key.end(), Key.begin(),
+                   [](unsigned char Character) { return (char)std::tolower(Character); });
+#endif
+
+    return Key;
+}
+
+// Reduces https, ssh and scp-like URLs of the same repository to one form, e.g. "github.com/owner/repo".
+std::string RemoteKey(const std::string &URL)
+{
+    std::string Key = URL;
+    size_t Scheme = Key.find("://");
+
+    if (Scheme != std::string::npos)
+        Key.erase(0, Scheme + 3);
+
+    size_t At = Key.find('@');
+
+    if (At != std::string::npos && At < Key.find('/'))
+        Key.erase(0, At + 1);
+
+    size_t Colon = Key.find(':');
+
+    // "scheme://host:22/owner/repo" drops the port, while in the scp form "host:1337owner/repo" the digits belong to
+    // the path and only the colon goes. Both become "host/owner/repo".
+    if (Colon != std::string::npos && Colon < Key.find('/'))
+    {
+        size_t End = Colon + 1;
+
+        if (Scheme != std::string::npos)
+            while (End < Key.size() && std::isdigit((unsigned char)Key[End]))
+                End++;
+
+        if (Scheme == std::string::npos)
+            Key.replace(Colon, 1, End < Key.size() && Key[End] == '/' ? "" : "/");
+        else if (End < Key.size() && Key[End] == '/')
+            Key.erase(Colon, End - Colon);
+    }
+
+    while (!Key.empty() && Key.back() == '/')
+        Key.pop_back();
+
+    if (Key.size() > 4 && Key.compare(Key.size() - 4, 4, ".git") == 0)
+        Key.resize(Key.size() - 4);
+
+    std::transform(Key.begin(), Key.end(), Key.begin(),
+                   [](unsigned char Character) { return (char)std::tolower(Character); });
+
+    return Key;
+}
+
+bool IsMainThread()
+{
+    return std::this_thread::get_id() == MainThread;
+}
+} // namespace Git::Core
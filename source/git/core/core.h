@@ -8,4 +8,8 @@ void Initialize(GarrysMod::Lua::ILuaBase *LUA);
 void Shutdown(GarrysMod::Lua::ILuaBase *LUA);
 
 std::string RelativePathToFullPath(const std::string &RelativePath);
+std::string FullPathToRelativePath(const std::string &FullPath);
+std::string PathKey(const std::string &Path);
+std::string RemoteKey(const std::string &URL);
+bool IsMainThread();
 } // namespace Git::Core
\ No newline at end of file
@@ -0,0 +1,300 @@
+#include "dispatcher.h"
+#include "../logger/logger.h"
+
+namespace Git::Dispatcher
+{
+struct Completion
+{
+    std::atomic<Completion *> Next{nullptr};
+    std::shared_ptr<GitOperation> Operation;
+    std::function<void(GarrysMod::Lua::ILuaBase *)> Task;
+};
+
+// Intrusive multi-producer single-consumer queue: workers push, only the main thread pops.
+static Completion Stub;
+static std::atomic<Completion *> Head{&Stub};
+static Completion *Tail = &Stub;
+static std::atomic<size_t> Budget{16};
+
+static void Push(Completion *Node)
+{
+    Node->Next.store(nullptr, std::memory_order_relaxed);
+    Completion *Previous = Head.exchange(Node, std::memory_order_acq_rel);
+    Previous->Next.store(Node, std::memory_order_release);
+}
+
+static Completion *Pop()
+{
+    Completion *Current = Tail;
+    Completion *Next = Current->Next.load(std::memory_order_acquire);
+
+    if (Current == &Stub)
+    {
+        if (!Next)
+            return nullptr;
+
+        Tail = Next;
+        Current = Next;
+        Next = Next->Next.load(std::memory_order_acquire);
+    }
+
+    if (Next)
+    {
+        Tail = Next;
+        return Current;
+    }
+
+    // A producer has swapped Head but not linked its node yet; pick it up next tick.
+    if (Current != Head.load(std::memory_order_acquire))
+        return nullptr;
+
+    Push(&Stub);
+    Next = Current->Next.load(std::memory_order_acquire);
+
+    if (Next)
+    {
+        Tail = Next;
+        return Current;
+    }
+
+    return nullptr;
+}
+
+void Initialize(GarrysMod::Lua::ILuaBase *LUA)
+{
+    LUA->PushSpecial(GarrysMod::Lua::SPECIAL_GLOB);
+    LUA->GetField(-1, "hook");
+
+    if (LUA->IsType(-1, GarrysMod::Lua::Type::Table))
+    {
+        LUA->GetField(-1, "Add");
+        LUA->PushString("Think");
+        LUA->PushString("gmsv_git");
+        LUA->PushCFunction(Think);
+        LUA->Call(3, 0);
+    }
+    else
+        Logger::Log(Logger::Error("Failed to find {red}hook{white} library, callbacks will not run!"));
+
+    LUA->Pop(2);
+}
+
+void Shutdown(GarrysMod::Lua::ILuaBase *LUA)
+{
+    while (Completion *Node = Pop())
+    {
+        if (Node->Operation)
+        {
+            LUA->ReferenceFree(Node->Operation->Callback);
+            Node->Operation->Callback = NO_CALLBACK;
+        }
+
+        delete Node;
+    }
+
+    LUA->PushSpecial(GarrysMod::Lua::SPECIAL_GLOB);
+    LUA->GetField(-1, "hook");
+
+    if (LUA->IsType(-1, GarrysMod::Lua::Type::Table))
+    {
+        LUA->GetField(-1, "Remove");
+        LUA->PushString("Think");
+        LUA->PushString("gmsv_git");
+        LUA->Call(2, 0);
+    }
+
+    LUA->Pop(2);
+}
+
+void Complete(const std::shared_ptr<GitOperation> &Operation)
+{
+    if (Operation->Callback == NO_CALLBACK)
+        return;
+
+    Completion *Node = new Completion();
+    Node->Operation = Operation;
+
+    Push(Node);
+}
+
+void Post(std::function<void(GarrysMod::Lua::ILuaBase *)> Task)
+{
+    Completion *Node = new Completion();
+    Node->Task = std::move(Task);
+
+    Push(Node);
+}
+
+void RunHook(GarrysMod::Lua::ILuaBase *LUA, const char *Name, const std::vector<std::string> &Arguments)
+{
+    LUA->PushSpecial(GarrysMod::Lua::SPECIAL_GLOB);
+    LUA->GetField(-1, "hook");
+
+    if (!LUA->IsType(-1, GarrysMod::Lua::Type::Table))
+    {
+        LUA->Pop(2);
+        return;
+    }
+
+    LUA->GetField(-1, "Run");
+    LUA->PushString(Name);
+
+    for (const std::string &Argument : Arguments)
+        LUA->PushString(Argument.c_str());
+
+    if (LUA->PCall((int)Arguments.size() + 1, 0, 0) != 0)
+    {
+        const char *Message = LUA->GetString(-1);
+
+        Logger::Log(Logger::Error("Hook {cyan}%s{white} failed: {red}%s"), Name, Message ? Message : "Unknown error");
+        LUA->Pop();
+    }
+
+    LUA->Pop(2);
+}
+
+void SetBudget(size_t Value)
+{
+    Budget.store(std::max<size_t>(Value, 1), std::memory_order_relaxed);
+}
+
+int ReferenceCallback(GarrysMod::Lua::ILuaBase *LUA, int StackPos)
+{
+    for (int Index = StackPos; Index <= LUA->Top(); ++Index)
+    {
+        if (!LUA->IsType(Index, GarrysMod::Lua::Type::Function))
+            continue;
+
+        LUA->Push(Index);
+        return LUA->ReferenceCreate();
+    }
+
+    return NO_CALLBACK;
+}
+
+void PushResult(GarrysMod::Lua::ILuaBase *LUA, const GitResult &Result)
+{
+    LUA->CreateTable();
+
+    LUA->PushNumber((double)Result.Code);
+    LUA->SetField(-2, "Code");
+
+    LUA->PushString(GitCodeName(Result.Code));
+    LUA->SetField(-2, "Name");
+
+    LUA->PushBool(GitCodeSucceeded(Result.Code));
+    LUA->SetField(-2, "Success");
+
+    if (!Result.OldOid.empty())
+    {
+        LUA->PushString(Result.OldOid.c_str());
+        LUA->SetField(-2, "OldHash");
+    }
+
+    if (!Result.NewOid.empty())
+    {
+        LUA->PushString(Result.NewOid.c_str());
+        LUA->SetField(-2, "NewHash");
+    }
+
+    if (!Result.Error.empty())
+    {
+        LUA->PushString(Result.Error.c_str());
+        LUA->SetField(-2, "Error");
+    }
+
+    if (!Result.Files.empty())
+    {
+        LUA->CreateTable();
+
+        for (size_t Index = 0; Index < Result.Files.size(); ++Index)
+        {
+            LUA->PushNumber((double)(Index + 1));
+            LUA->PushString(Result.Files[Index].c_str());
+            LUA->SetTable(-3);
+        }
+
+        LUA->SetField(-2, "Files");
+    }
+
+    for (const std::pair<const std::string, double> &Number : Result.Numbers)
+    {
+        LUA->PushNumber(Number.second);
+        LUA->SetField(-2, Number.first.c_str());
+    }
+
+    if (Result.Snapshot)
+        PushSnapshot(LUA, *Result.Snapshot);
+}
+
+// Sets the snapshot fields on the table at the top of the stack.
+void PushSnapshot(GarrysMod::Lua::ILuaBase *LUA, const GitSnapshot &Snapshot)
+{
+    LUA->PushString(Snapshot.Branch.c_str());
+    LUA->SetField(-2, "Branch");
+
+    LUA->PushString(Snapshot.Hash.c_str());
+    LUA->SetField(-2, "Hash");
+
+    LUA->PushString(Snapshot.ShortHash.c_str());
+    LUA->SetField(-2, "ShortHash");
+
+    if (!Snapshot.Upstream.empty())
+    {
+        LUA->PushString(Snapshot.Upstream.c_str());
+        LUA->SetField(-2, "Upstream");
+    }
+
+    LUA->PushBool(Snapshot.Complete);
+    LUA->SetField(-2, "Complete");
+
+    if (!Snapshot.Complete)
+        return;
+
+    LUA->PushBool(Snapshot.Dirty);
+    LUA->SetField(-2, "Dirty");
+
+    LUA->PushNumber((double)Snapshot.Ahead);
+    LUA->SetField(-2, "Ahead");
+
+    LUA->PushNumber((double)Snapshot.Behind);
+    LUA->SetField(-2, "Behind");
+}
+
+LUA_FUNCTION(Think)
+{
+    size_t Remaining = Budget.load(std::memory_order_relaxed);
+
+    while (Remaining-- > 0)
+    {
+        Completion *Node = Pop();
+
+        if (!Node)
+            break;
+
+        if (Node->Task)
+        {
+            Node->Task(LUA);
+            delete Node;
+            continue;
+        }
+
+        LUA->ReferencePush(Node->Operation->Callback);
+        PushResult(LUA, Node->Operation->Result);
+
+        if (LUA->PCall(1, 0, 0) != 0)
+        {
+            const char *Message = LUA->GetString(-1);
+
+            Logger::Log(Logger::Error("Callback failed: {red}%s"), Message ? Message : "Unknown error");
+            LUA->Pop();
+        }
+
+        LUA->ReferenceFree(Node->Operation->Callback);
+        Node->Operation->Callback = NO_CALLBACK;
+        delete Node;
+    }
+
+    return 0;
+}
+} // namespace Git::Dispatcher
@@ -0,0 +1,22 @@
+#pragma once
+#include "../includes.h"
+#include "../operation/operation.h"
+
+namespace Git::Dispatcher
+{
+constexpr int NO_CALLBACK = -1;
+
+void Initialize(GarrysMod::Lua::ILuaBase *LUA);
+void Shutdown(GarrysMod::Lua::ILuaBase *LUA);
+
+// Safe to call from any thread; the callback runs on the main thread during Think.
+void Complete(const std::shared_ptr<GitOperation> &Operation);
+void Post(std::function<void(GarrysMod::Lua::ILuaBase *)> Task);
+void RunHook(GarrysMod::Lua::ILuaBase *LUA, const char *Name, const std::vector<std::string> &Arguments);
+void SetBudget(size_t Budget);
+
+int ReferenceCallback(GarrysMod::Lua::ILuaBase *LUA, int StackPos);
+void PushResult(GarrysMod::Lua::ILuaBase *LUA, const GitResult &Result);
+void PushSnapshot(GarrysMod::Lua::ILuaBase *LUA, const GitSnapshot &Snapshot);
+int Think(lua_State *L);
+} // namespace Git::Dispatcher
@@ -1,21 +1,40 @@
 #include "functions.h"
 #include "../core/core.h"
 #include "../logger/logger.h"
+#include "../pool/pool.h"
+#include "../dispatcher/dispatcher.h"
+#include "../watchdog/watchdog.h"
+#include "../cache/cache.h"
+#include "../snapshot/snapshot.h"
+#include "../watcher/watcher.h"
+#include "../updater/updater.h"
+#include "../webhook/webhook.h"
+#include "../sparse/sparse.h"
+#include "../promisor/promisor.h"
+#include "../history/history.h"
+#include "../stage/stage.h"
+#include "../store/store.h"
+#include "../reference/reference.h"
+#include "../copy/copy.h"
+#include <git2/sys/errors.h>
 
 namespace Git::Functions
 {
 LUA_FUNCTION(Clone)
 {
-    time_t Time = std::time(nullptr);
     std::string Token = GetGithubAccessToken();
     std::string URL = LUA->CheckString(1);
     std::string Directory = LUA->CheckString(2);
     std::string Path = Core::RelativePathToFullPath(Directory);
-    std::string TempPath = Core::RelativePathToFullPath(std::string("TEMP_CLONE_").append(std::to_string(Time)));
+    GitCloneOptions Options = ParseCloneOptions(LUA, 3);
 
-    std::thread([=]() { HandleGitClone(URL, Directory, Path, TempPath, Token); }).detach();
+    int Callback = Dispatcher::ReferenceCallback(LUA, 3);
 
-    return 0;
+    Schedule(LUA, Path, Token, Callback, [=](GitOperation &Operation) {
+        HandleGitClone(URL, Directory, Path, Options, Operation);
+    });
+
+    return 1;
 }
 
 LUA_FUNCTION(Pull)
@@ -24,9 +43,14 @@ LUA_FUNCTION(Pull)
     std::string Directory = LUA->CheckString(1);
     std::string Path = Core::RelativePathToFullPath(Directory);
 
-    std::thread([=]() { HandleGitPull(Directory, Path, Token); }).detach();
+    std::optional<std::vector<std::string>> Sparse = ParseSparsePatterns(LUA, 2);
 
-    return 0;
+    int Callback = Dispatcher::ReferenceCallback(LUA, 2);
+
+    Schedule(LUA, Path, Token, Callback,
+             [=](GitOperation &Operation) { HandleGitPull(Directory, Path, Sparse, Operation); });
+
+    return 1;
 }
 
 LUA_FUNCTION(Checkout)
@@ -35,10 +59,84 @@ LUA_FUNCTION(Checkout)
     std::string Directory = LUA->CheckString(1);
     std::string Path = Core::RelativePathToFullPath(Directory);
     std::string Head = LUA->CheckString(2);
+    std::optional<std::vector<std::string>> Sparse = ParseSparsePatterns(LUA, 3);
 
-    std::thread([=]() { HandleGitCheckout(Directory, Path, Head, Token); }).detach();
+    int Callback = Dispatcher::ReferenceCallback(LUA, 3);
 
-    return 0;
+    Schedule(LUA, Path, Token, Callback, [=](GitOperation &Operation) {
+        HandleGitCheckout(Directory, Path, Head, Sparse, Operation);
+    });
+
+    return 1;
+}
+
+LUA_FUNCTION(Prepare)
+{
+    std::string Token = GetGithubAccessToken();
+    std::string Directory = LUA->CheckString(1);
+    std::string Path = Core::RelativePathToFullPath(Directory);
+
+    int Callback = Dispatcher::ReferenceCallback(LUA, 2);
+
+    Schedule(LUA, Path, Token, Callback,
+             [=](GitOperation &Operation) { HandleGitPrepare(Directory, Path, Operation); });
+
+    return 1;
+}
+
+LUA_FUNCTION(Apply)
+{
+    std::string Token = GetGithubAccessToken();
+    std::string Directory = LUA->CheckString(1);
+    std::string Path = Core::RelativePathToFullPath(Directory);
+
+    int Callback = Dispatcher::ReferenceCallback(LUA, 2);
+
+    Schedule(LUA, Path, Token, Callback,
+             [=](GitOperation &Operation) { HandleGitApply(Directory, Path, Operation); });
+
+    return 1;
+}
+
+LUA_FUNCTION(Rollback)
+{
+    std::string Token = GetGithubAccessToken();
+    std::string Directory = LUA->CheckString(1);
+    std::string Path = Core::RelativePathToFullPath(Directory);
+    int Steps = LUA->IsType(2, GarrysMod::Lua::Type::Number) ? (int)LUA->GetNumber(2) : 1;
+
+    int Callback = Dispatcher::ReferenceCallback(LUA, 2);
+
+    Schedule(LUA, Path, Token, Callback,
+             [=](GitOperation &Operation) { HandleGitRollback(Directory, Path, Steps, Operation); });
+
+    return 1;
+}
+
+LUA_FUNCTION(GetHistory)
+{
+    std::string Path = Core::RelativePathToFullPath(LUA->CheckString(1));
+    std::error_code ErrorCode;
+
+    if (!std::filesystem::exists(std::filesystem::path(Path) / ".git", ErrorCode))
+    {
+        LUA->PushNil();
+        return 1;
+    }
+
+    std::vector<std::string> Hashes = History::Load(Path);
+
+    LUA->CreateTable();
+
+    // Newest first, so index N is what Rollback(directory, N) goes back to.
+    for (size_t Index = 0; Index < Hashes.size(); ++Index)
+    {
+        LUA->PushNumber((double)(Index + 1));
+        LUA->PushString(Hashes[Hashes.size() - Index - 1].c_str());
+        LUA->SetTable(-3);
+    }
+
+    return 1;
 }
 
 LUA_FUNCTION(Add)
@@ -48,9 +146,13 @@ LUA_FUNCTION(Add)
     std::string Path = Core::RelativePathToFullPath(Directory);
     std::string File = LUA->CheckString(2);
 
-    std::thread([=]() { HandleGitAdd(Directory, Path, File, Token); }).detach();
+    int Callback = Dispatcher::ReferenceCallback(LUA, 3);
 
-    return 0;
+    Schedule(LUA, Path, Token, Callback, [=](GitOperation &Operation) {
+        HandleGitAdd(Directory, Path, File, Operation);
+    });
+
+    return 1;
 }
 
 LUA_FUNCTION(Commit)
@@ -62,9 +164,13 @@ LUA_FUNCTION(Commit)
     std::string AuthorName = LUA->IsType(3, GarrysMod::Lua::Type::String) ? LUA->GetString(3) : std::string();
     std::string AuthorEmail = LUA->IsType(4, GarrysMod::Lua::Type::String) ? LUA->GetString(4) : std::string();
 
-    std::thread([=]() { HandleGitCommit(Directory, Path, Message, AuthorName, AuthorEmail, Token); }).detach();
+    int Callback = Dispatcher::ReferenceCallback(LUA, 3);
 
-    return 0;
+    Schedule(LUA, Path, Token, Callback, [=](GitOperation &Operation) {
+        HandleGitCommit(Directory, Path, Message, AuthorName, AuthorEmail, Operation);
+    });
+
+    return 1;
 }
 
 LUA_FUNCTION(Push)
@@ -73,45 +179,534 @@ LUA_FUNCTION(Push)
     std::string Directory = LUA->CheckString(1);
     std::string Path = Core::RelativePathToFullPath(Directory);
 
-    std::thread([=]() { HandleGitPush(Directory, Path, Token); }).detach();
+    int Callback = Dispatcher::ReferenceCallback(LUA, 2);
 
-    return 0;
+    Schedule(LUA, Path, Token, Callback, [=](GitOperation &Operation) { HandleGitPush(Directory, Path, Operation); });
+
+    return 1;
 }
 
 LUA_FUNCTION(GetBranch)
 {
-    std::string Token = GetGithubAccessToken();
     std::string Directory = LUA->CheckString(1);
     std::string Path = Core::RelativePathToFullPath(Directory);
-    GitRepository Repository(Path, Token);
+    std::shared_ptr<const GitSnapshot> State = GetSnapshot(Path);
 
-    if (!Repository.Valid())
+    if (!State)
         return 0;
 
-    std::string Branch = Repository.GetBranch();
-
-    LUA->PushString(Branch.c_str());
+    LUA->PushString(State->Branch.c_str());
 
     return 1;
 }
 
 LUA_FUNCTION(GetShortHash)
 {
-    std::string Token = GetGithubAccessToken();
     std::string Directory = LUA->CheckString(1);
     std::string Path = Core::RelativePathToFullPath(Directory);
-    GitRepository Repository(Path, Token);
+    std::shared_ptr<const GitSnapshot> State = GetSnapshot(Path);
 
-    if (!Repository.Valid())
+    if (!State)
+        return 0;
+
+    LUA->PushString(State->ShortHash.c_str());
+
+    return 1;
+}
+
+LUA_FUNCTION(Describe)
+{
+    std::string Directory = LUA->CheckString(1);
+    std::string Path = Core::RelativePathToFullPath(Directory);
+    std::shared_ptr<const GitSnapshot> State = GetSnapshot(Path);
+
+    if (!State)
         return 0;
 
-    std::string Hash = Repository.GetShortHash();
+    LUA->CreateTable();
+    Dispatcher::PushSnapshot(LUA, *State);
+
+    return 1;
+}
+
+LUA_FUNCTION(DescribeAsync)
+{
+    std::string Directory = LUA->CheckString(1);
+    std::string Path = Core::RelativePathToFullPath(Directory);
+
+    int Callback = Dispatcher::ReferenceCallback(LUA, 2);
+
+    Schedule(
+        LUA, Path, std::string(), Callback,
+        [=](GitOperation &Operation) { HandleGitDescribe(Directory, Path, Operation); }, false);
+
+    return 1;
+}
+
+LUA_FUNCTION(CheckRemote)
+{
+    std::string Token = GetGithubAccessToken();
+    std::string Directory = LUA->CheckString(1);
+    std::string Path = Core::RelativePathToFullPath(Directory);
+
+    int Callback = Dispatcher::ReferenceCallback(LUA, 2);
+
+    Schedule(
+        LUA, Path, Token, Callback, [=](GitOperation &Operation) { HandleGitCheckRemote(Directory, Path, Operation); },
+        false);
+
+    return 1;
+}
+
+LUA_FUNCTION(AutoUpdate)
+{
+    std::string Directory = LUA->CheckString(1);
+    std::string Path = Core::RelativePathToFullPath(Directory);
+    double Interval = 300;
+    std::string Branch;
+    GitUpdatePolicy Policy = GitUpdatePolicy::FASTFORWARD;
+
+    if (LUA->IsType(2, GarrysMod::Lua::Type::Table))
+    {
+        LUA->GetField(2, "Interval");
+
+        if (LUA->IsType(-1, GarrysMod::Lua::Type::Number))
+            Interval = LUA->GetNumber(-1);
+
+        LUA->GetField(2, "Branch");
+
+        if (LUA->IsType(-1, GarrysMod::Lua::Type::String))
+            Branch = LUA->GetString(-1);
+
+        LUA->GetField(2, "Policy");
+
+        if (LUA->IsType(-1, GarrysMod::Lua::Type::String) && !Updater::ParsePolicy(LUA->GetString(-1), Policy))
+            LUA->ArgError(2, "Policy must be \"fetch\", \"fastforward\" or \"mapchange\"");
+
+        LUA->Pop(3);
+    }
+
+    Updater::Register(Directory, Path, Interval, Branch, Policy);
+    Logger::Log(Logger::Info("Auto-updating {cyan}%s{white} every {yellow}%.0f{white}s ({yellow}%s{white})."),
+                Directory.c_str(), std::max(Interval, 10.0), Updater::PolicyName(Policy));
+
+    return 0;
+}
+
+LUA_FUNCTION(StopAutoUpdate)
+{
+    std::string Directory = LUA->CheckString(1);
+    std::string Path = Core::RelativePathToFullPath(Directory);
+
+    LUA->PushBool(Updater::Unregister(Path));
+
+    return 1;
+}
+
+LUA_FUNCTION(StartWebhook)
+{
+    double Port = LUA->CheckNumber(1);
+    std::string Secret = LUA->CheckString(2);
+    std::string Bind = LUA->IsType(3, GarrysMod::Lua::Type::String) ? LUA->GetString(3) : "127.0.0.1";
+
+    if (Port < 1 || Port > 65535)
+        LUA->ArgError(1, "Port must be between 1 and 65535");
+
+    if (Secret.empty())
+        LUA->ArgError(2, "A secret is required to verify payloads");
+
+    LUA->PushBool(Webhook::Start((unsigned short)Port, Secret, Bind));
+
+    return 1;
+}
+
+LUA_FUNCTION(StopWebhook)
+{
+    Webhook::Stop();
+
+    return 0;
+}
+
+LUA_FUNCTION(Deepen)
+{
+    std::string Token = GetGithubAccessToken();
+    std::string Directory = LUA->CheckString(1);
+    std::string Path = Core::RelativePathToFullPath(Directory);
+    int Depth = (int)LUA->CheckNumber(2);
+
+    int Callback = Dispatcher::ReferenceCallback(LUA, 3);
+
+    Schedule(LUA, Path, Token, Callback,
+             [=](GitOperation &Operation) { HandleGitDeepen(Directory, Path, Depth, Operation); });
+
+    return 1;
+}
+
+LUA_FUNCTION(SetAtomic)
+{
+    std::string Directory = LUA->CheckString(1);
+    std::string Path = Core::RelativePathToFullPath(Directory);
+    bool Atomic = LUA->GetBool(2);
+
+    int Callback = Dispatcher::ReferenceCallback(LUA, 3);
 
-    LUA->PushString(Hash.c_str());
+    Schedule(
+        LUA, Path, std::string(), Callback,
+        [=](GitOperation &Operation) { HandleSetAtomic(Directory, Path, Atomic, Operation); }, false);
 
     return 1;
 }
 
+LUA_FUNCTION(SetBlobStore)
+{
+    std::string Directory = LUA->CheckString(1);
+    std::string Path = Core::RelativePathToFullPath(Directory);
+    std::string BlobStore = LUA->IsType(2, GarrysMod::Lua::Type::String) ? StorePath(LUA->GetString(2)) : "";
+
+    int Callback = Dispatcher::ReferenceCallback(LUA, 2);
+
+    Schedule(
+        LUA, Path, std::string(), Callback,
+        [=](GitOperation &Operation) { HandleSetBlobStore(Directory, Path, BlobStore, Operation); }, false);
+
+    return 1;
+}
+
+LUA_FUNCTION(PruneBlobStore)
+{
+    std::string BlobStore = StorePath(LUA->CheckString(1));
+
+    int Callback = Dispatcher::ReferenceCallback(LUA, 2);
+
+    Schedule(
+        LUA, BlobStore, std::string(), Callback,
+        [=](GitOperation &Operation) { HandlePruneBlobStore(BlobStore, Operation); }, false);
+
+    return 1;
+}
+
+LUA_FUNCTION(MeasureCopy)
+{
+    std::string Source = Core::RelativePathToFullPath(LUA->CheckString(1));
+    std::string Destination = Core::RelativePathToFullPath(LUA->CheckString(2));
+    bool HardLink = LUA->IsType(3, GarrysMod::Lua::Type::Bool) && LUA->GetBool(3);
+
+    int Callback = Dispatcher::ReferenceCallback(LUA, 3);
+
+    Schedule(
+        LUA, Destination, std::string(), Callback,
+        [=](GitOperation &Operation) { HandleMeasureCopy(Source, Destination, HardLink, Operation); }, false);
+
+    return 1;
+}
+
+LUA_FUNCTION(SetCallbackBudget)
+{
+    int Budget = (int)LUA->CheckNumber(1);
+
+    if (Budget < 1)
+        LUA->ArgError(1, "callback budget must be at least 1");
+
+    Dispatcher::SetBudget((size_t)Budget);
+
+    return 0;
+}
+
+LUA_FUNCTION(SetTimeouts)
+{
+    LUA->CheckType(1, GarrysMod::Lua::Type::Table);
+
+    double Timeouts[3] = {30, 120, 300};
+    const char *Fields[3] = {"Connect", "Transfer", "Checkout"};
+
+    for (int Index = 0; Index < 3; ++Index)
+    {
+        LUA->GetField(1, Fields[Index]);
+
+        if (LUA->IsType(-1, GarrysMod::Lua::Type::Number))
+            Timeouts[Index] = LUA->GetNumber(-1);
+
+        LUA->Pop();
+    }
+
+    Watchdog::SetTimeouts(Timeouts[0], Timeouts[1], Timeouts[2]);
+
+    return 0;
+}
+
+LUA_FUNCTION(SetRepositoryCacheSize)
+{
+    int Size = (int)LUA->CheckNumber(1);
+
+    if (Size < 1)
+        LUA->ArgError(1, "cache size must be at least 1");
+
+    Cache::SetCapacity((size_t)Size);
+
+    return 0;
+}
+
+LUA_FUNCTION(SetWorkerCount)
+{
+    int Count = (int)LUA->CheckNumber(1);
+
+    if (Count < 1)
+        LUA->ArgError(1, "worker count must be at least 1");
+
+    Pool::SetWorkerCount((size_t)Count);
+
+    return 0;
+}
+
+LUA_FUNCTION(GetPoolStats)
+{
+    LUA->CreateTable();
+
+    LUA->PushNumber((double)Pool::GetWorkerCount());
+    LUA->SetField(-2, "Workers");
+
+    LUA->PushNumber((double)Pool::GetQueueDepth());
+    LUA->SetField(-2, "Queued");
+
+    LUA->PushNumber((double)Pool::GetInFlight());
+    LUA->SetField(-2, "InFlight");
+
+    LUA->PushNumber((double)Pool::GetRepositoryCount());
+    LUA->SetField(-2, "Repositories");
+
+    LUA->PushNumber((double)Cache::GetSize());
+    LUA->SetField(-2, "CachedRepositories");
+
+    return 1;
+}
+
+// Stores are usually shared between server instances, so absolute paths are taken as they are.
+std::string StorePath(const std::string &Store)
+{
+    return std::filesystem::path(Store).is_absolute() ? Store : Core::RelativePathToFullPath(Store);
+}
+
+GitCloneOptions ParseCloneOptions(GarrysMod::Lua::ILuaBase *LUA, int StackPos)
+{
+    GitCloneOptions Options;
+
+    if (!LUA->IsType(StackPos, GarrysMod::Lua::Type::Table))
+        return Options;
+
+    LUA->GetField(StackPos, "Depth");
+
+    if (LUA->IsType(-1, GarrysMod::Lua::Type::Number))
+        Options.Depth = std::max((int)LUA->GetNumber(-1), 0);
+
+    LUA->GetField(StackPos, "Branch");
+
+    if (LUA->IsType(-1, GarrysMod::Lua::Type::String))
+        Options.Branch = LUA->GetString(-1);
+
+    LUA->GetField(StackPos, "SingleBranch");
+    Options.SingleBranch = LUA->GetBool(-1);
+
+    LUA->GetField(StackPos, "Root");
+
+    if (LUA->IsType(-1, GarrysMod::Lua::Type::String))
+        Options.Sparse.Root = Sparse::NormalizeRoot(LUA->GetString(-1));
+
+    LUA->GetField(StackPos, "Blobless");
+    Options.Blobless = LUA->GetBool(-1);
+
+    LUA->GetField(StackPos, "Atomic");
+    Options.Atomic = LUA->GetBool(-1);
+
+    LUA->GetField(StackPos, "Store");
+
+    if (LUA->IsType(-1, GarrysMod::Lua::Type::String))
+        Options.Store = StorePath(LUA->GetString(-1));
+
+    LUA->GetField(StackPos, "Reference");
+
+    if (LUA->IsType(-1, GarrysMod::Lua::Type::String))
+        Options.Reference = StorePath(LUA->GetString(-1));
+
+    LUA->Pop(8);
+
+    if (std::optional<std::vector<std::string>> Patterns = ParseSparsePatterns(LUA, StackPos))
+        Options.Sparse.Patterns = *Patterns;
+
+    return Options;
+}
+
+std::optional<std::vector<std::string>> ParseSparsePatterns(GarrysMod::Lua::ILuaBase *LUA, int StackPos)
+{
+    if (!LUA->IsType(StackPos, GarrysMod::Lua::Type::Table))
+        return std::nullopt;
+
+    LUA->GetField(StackPos, "Sparse");
+
+    if (!LUA->IsType(-1, GarrysMod::Lua::Type::Table))
+    {
+        LUA->Pop();
+        return std::nullopt;
+    }
+
+    std::vector<std::string> Patterns;
+
+    for (int Index = 1;; ++Index)
+    {
+        LUA->PushNumber(Index);
+        LUA->GetTable(-2);
+
+        if (!LUA->IsType(-1, GarrysMod::Lua::Type::String))
+        {
+            LUA->Pop();
+            break;
+        }
+
+        Patterns.push_back(LUA->GetString(-1));
+        LUA->Pop();
+    }
+
+    LUA->Pop();
+
+    return Patterns;
+}
+
+void Schedule(GarrysMod::Lua::ILuaBase *LUA, const std::string &Path, const std::string &Token, int Callback,
+              std::function<void(GitOperation &)> Handler, bool RefreshAfter)
+{
+    std::shared_ptr<GitOperation> Operation = std::make_shared<GitOperation>(Token, Callback);
+
+    Pool::Submit(Path, [=]() {
+        Operation->Start();
+        Watchdog::Watch(Operation);
+
+        bool Started = !Operation->Cancelled();
+
+        if (Started)
+            Handler(*Operation);
+
+        Watchdog::Unwatch(Operation);
+
+        if (Started && RefreshAfter)
+            RefreshSnapshot(Path, Operation->Touched ? &*Operation->Touched : nullptr);
+
+        Operation->Finish();
+        Dispatcher::Complete(Operation);
+    });
+
+    Operation::Push(LUA, Operation);
+}
+
+std::shared_ptr<const GitSnapshot> RefreshSnapshot(const std::string &Path, const std::vector<std::string> *Touched)
+{
+    GitRepository Repository(Path, std::string());
+
+    if (!Repository.Valid())
+    {
+        Snapshot::Invalidate(Path);
+        Watcher::Unwatch(Path);
+        return nullptr;
+    }
+
+    std::shared_ptr<const GitSnapshot> State = Snapshot::Refresh(Path, Repository.GetRepository(), Touched);
+    Watcher::Watch(Path, git_repository_path(Repository.GetRepository()));
+
+    return State;
+}
+
+// Moving between two commits only writes the paths their trees differ in. Anything that fails leaves Touched unset.
+void TrackChanges(git_repository *Repository, GitOperation &Operation)
+{
+    git_oid Old, New;
+    git_commit *OldCommit = nullptr, *NewCommit = nullptr;
+    git_tree *OldTree = nullptr, *NewTree = nullptr;
+    git_diff *Diff = nullptr;
+
+    if (!GitCodeSucceeded(Operation.Result.Code) || git_oid_fromstr(&Old, Operation.Result.OldOid.c_str()) != 0 ||
+        git_oid_fromstr(&New, Operation.Result.NewOid.c_str()) != 0)
+        return;
+
+    if (git_oid_equal(&Old, &New))
+    {
+        Operation.Touched.emplace();
+        return;
+    }
+
+    if (git_commit_lookup(&OldCommit, Repository, &Old) == 0 && git_commit_lookup(&NewCommit, Repository, &New) == 0 &&
+        git_commit_tree(&OldTree, OldCommit) == 0 && git_commit_tree(&NewTree, NewCommit) == 0 &&
+        git_diff_tree_to_tree(&Diff, Repository, OldTree, NewTree, nullptr) == 0)
+    {
+        std::vector<std::string> Paths;
+
+        for (size_t Index = 0; Index < git_diff_num_deltas(Diff); ++Index)
+        {
+            const git_diff_delta *Delta = git_diff_get_delta(Diff, Index);
+
+            Paths.push_back(Delta->status == GIT_DELTA_DELETED ? Delta->old_file.path : Delta->new_file.path);
+        }
+
+        Operation.Touched = std::move(Paths);
+    }
+
+    git_diff_free(Diff);
+    git_tree_free(NewTree);
+    git_tree_free(OldTree);
+    git_commit_free(NewCommit);
+    git_commit_free(OldCommit);
+}
+
+void OnRefsChanged(const std::string &Path)
+{
+    Pool::Submit(Path, [=]() {
+        std::shared_ptr<const GitSnapshot> Previous = Snapshot::Get(Path);
+        GitRepository Repository(Path, std::string());
+
+        if (!Repository.Valid())
+        {
+            Snapshot::Invalidate(Path);
+            Watcher::Unwatch(Path);
+            return;
+        }
+
+        std::shared_ptr<const GitSnapshot> State = Snapshot::Refresh(Path, Repository.GetRepository());
+
+        if (Previous && Previous->Branch == State->Branch && Previous->Hash == State->Hash &&
+            Previous->Upstream == State->Upstream)
+            return;
+
+        std::vector<std::string> Arguments = {Core::FullPathToRelativePath(Path), State->Branch,
+                                              Previous ? Previous->Hash : std::string(), State->Hash};
+
+        Dispatcher::Post([=](GarrysMod::Lua::ILuaBase *LUA) { Dispatcher::RunHook(LUA, "GitRefChanged", Arguments); });
+    });
+}
+
+std::shared_ptr<const GitSnapshot> GetSnapshot(const std::string &Path)
+{
+    std::shared_ptr<const GitSnapshot> State = Snapshot::Get(Path);
+
+    if (State)
+        return State;
+
+    GitRepository Repository(Path, std::string());
+
+    if (!Repository.Valid())
+        return nullptr;
+
+    // Serve the cheap fields now and let a worker fill in the rest.
+    State = Snapshot::Capture(Repository.GetRepository(), false);
+    Snapshot::Publish(Path, State);
+    Pool::Submit(Path, [=]() { RefreshSnapshot(Path); });
+
+    return State;
+}
+
+std::string GetLastErrorMessage()
+{
+    const git_error *ErrorStack = git_error_last();
+
+    return (ErrorStack && ErrorStack->message) ? ErrorStack->message : "Unknown error";
+}
+
 std::string Pastelize(const std::string& Text)
 {
     static std::string Colors[] = {
@@ -203,9 +798,18 @@ bool ShouldLogPercent(int PercentInt, int &LastPercent)
     return false;
 }
 
-int OnCloneFetchTransferProgress(const git_indexer_progress *Progress, void *)
+int OnCloneFetchTransferProgress(const git_indexer_progress *Progress, void *Payload)
 {
-    static int LastPercent = -1;
+    GitOperation *Operation = (GitOperation *)Payload;
+
+    Operation->EnterPhase(GitOperationPhase::TRANSFER);
+    Operation->ReceivedObjects.store(Progress->received_objects);
+    Operation->IndexedObjects.store(Progress->indexed_objects);
+    Operation->TotalObjects.store(Progress->total_objects);
+    Operation->ReceivedBytes.store(Progress->received_bytes);
+
+    if (Operation->Cancelled())
+        return -1;
 
     if (Progress->total_objects == 0)
         return 0;
@@ -213,21 +817,37 @@ int OnCloneFetchTransferProgress(const git_indexer_progress *Progress, void *)
     double Percent = (double)Progress->received_objects / (double)Progress->total_objects;
     int PercentInt = (int)(Percent * 100);
 
-    if (!ShouldLogPercent(PercentInt, LastPercent))
+    if (!ShouldLogPercent(PercentInt, Operation->TransferPercent))
         return 0;
 
     std::string Bar = ProgressBar(Percent);
 
     Git::Logger::Log(Git::Logger::Info("Cloning repository: {yellow}%s"), Bar.c_str());
 
-    LastPercent = PercentInt;
+    Operation->TransferPercent = PercentInt;
 
     return 0;
 }
 
-void OnCloneCheckoutProgress(const char *Path, size_t CompletedSteps, size_t TotalSteps, void *)
+int OnPushTransferProgress(unsigned int Current, unsigned int Total, size_t Bytes, void *Payload)
+{
+    GitOperation *Operation = (GitOperation *)Payload;
+
+    Operation->EnterPhase(GitOperationPhase::TRANSFER);
+    Operation->ReceivedObjects.store(Current);
+    Operation->TotalObjects.store(Total);
+    Operation->ReceivedBytes.store(Bytes);
+
+    return Operation->Cancelled() ? -1 : 0;
+}
+
+void OnCloneCheckoutProgress(const char *Path, size_t CompletedSteps, size_t TotalSteps, void *Payload)
 {
-    static int LastPercent = -1;
+    GitOperation *Operation = (GitOperation *)Payload;
+
+    Operation->EnterPhase(GitOperationPhase::CHECKOUT);
+    Operation->CheckoutSteps.store(CompletedSteps);
+    Operation->TotalCheckoutSteps.store(TotalSteps);
 
     if (TotalSteps == 0)
         return;
@@ -235,7 +855,7 @@ void OnCloneCheckoutProgress(const char *Path, size_t CompletedSteps, size_t Tot
     double Percent = (double)CompletedSteps / (double)TotalSteps;
     int PercentInt = (int)(Percent * 100);
 
-    if (!ShouldLogPercent(PercentInt, LastPercent))
+    if (!ShouldLogPercent(PercentInt, Operation->CheckoutPercent))
         return;
 
     std::string Bar = ProgressBar(Percent);
@@ -243,7 +863,34 @@ void OnCloneCheckoutProgress(const char *Path, size_t CompletedSteps, size_t Tot
     Git::Logger::Log(Git::Logger::Info("Checkout: {yellow}%d{white}/{yellow}%d {white}%s"), CompletedSteps, TotalSteps,
                      Bar.c_str());
 
-    LastPercent = PercentInt;
+    Operation->CheckoutPercent = PercentInt;
+}
+
+int OnRemoteReady(git_remote *, int, void *Payload)
+{
+    GitOperation *Operation = (GitOperation *)Payload;
+
+    Operation->EnterPhase(GitOperationPhase::CONNECT);
+
+    return Operation->Cancelled() ? -1 : 0;
+}
+
+int OnSidebandProgress(const char *, int, void *Payload)
+{
+    GitOperation *Operation = (GitOperation *)Payload;
+
+    Operation->Touch();
+
+    return Operation->Cancelled() ? -1 : 0;
+}
+
+int OnCheckoutNotify(git_checkout_notify_t, const char *, const git_diff_file *, const git_diff_file *,
+                     const git_diff_file *, void *Payload)
+{
+    GitOperation *Operation = (GitOperation *)Payload;
+
+    // The progress callback cannot abort, so cancellation is checked per file while checkout plans its work.
+    return Operation->Cancelled() ? GIT_EUSER : 0;
 }
 
 int DiffSummaryCallback(const git_diff_delta *Delta, float, void *)
@@ -275,9 +922,9 @@ int DiffSummaryCallback(const git_diff_delta *Delta, float, void *)
 
 int CredentialToken(git_credential **Output, const char *, const char *, unsigned int, void *Payload)
 {
-    const char *Token = (const char *)Payload;
+    GitOperation *Operation = (GitOperation *)Payload;
 
-    return git_credential_userpass_plaintext_new(Output, "git", Token);
+    return git_credential_userpass_plaintext_new(Output, "git", Operation->Token.c_str());
 }
 
 int CertificateCheck(git_cert *, int, const char *, void *)
@@ -285,6 +932,28 @@ int CertificateCheck(git_cert *, int, const char *, void *)
     return 0;
 }
 
+void SetupRemoteCallbacks(git_remote_callbacks &Callbacks, GitOperation *Operation)
+{
+    Callbacks.payload = Operation;
+    Callbacks.transfer_progress = OnCloneFetchTransferProgress;
+    Callbacks.push_transfer_progress = OnPushTransferProgress;
+    Callbacks.remote_ready = OnRemoteReady;
+    Callbacks.sideband_progress = OnSidebandProgress;
+    Callbacks.certificate_check = CertificateCheck;
+
+    if (!Operation->Token.empty())
+        Callbacks.credentials = CredentialToken;
+}
+
+void SetupCheckoutCallbacks(git_checkout_options &Options, GitOperation *Operation)
+{
+    Options.progress_cb = OnCloneCheckoutProgress;
+    Options.progress_payload = Operation;
+    Options.notify_cb = OnCheckoutNotify;
+    Options.notify_flags = GIT_CHECKOUT_NOTIFY_UPDATED;
+    Options.notify_payload = Operation;
+}
+
 std::string GetGithubAccessToken()
 {
     std::string TokenPath = Git::Core::RelativePathToFullPath("git.token");
@@ -308,118 +977,387 @@ void PrintGitDiffSummary(git_repository *Repository, const git_oid &OldOid, cons
     git_diff *Difference = nullptr;
     char A[16], B[16];
 
-    git_commit_lookup(&OldCommit, Repository, &OldOid);
-    git_commit_lookup(&NewCommit, Repository, &NewOid);
-    git_commit_tree(&OldTree, OldCommit);
-    git_commit_tree(&NewTree, NewCommit);
-    git_diff_tree_to_tree(&Difference, Repository, OldTree, NewTree, nullptr);
+    git_commit_lookup(&OldCommit, Repository, &OldOid);
+    git_commit_lookup(&NewCommit, Repository, &NewOid);
+    git_commit_tree(&OldTree, OldCommit);
+    git_commit_tree(&NewTree, NewCommit);
+    git_diff_tree_to_tree(&Difference, Repository, OldTree, NewTree, nullptr);
+
+    size_t Count = git_diff_num_deltas(Difference);
+
+    git_oid_tostr(A, sizeof(A), &OldOid);
+    git_oid_tostr(B, sizeof(B), &NewOid);
+    Git::Logger::Log(Git::Logger::Info("Updating {yellow}%s{white}..{yellow}%s"), A, B);
+
+    if (Count > 200)
+        Git::Logger::Log(Git::Logger::Info("Fast-forward"));
+    else
+        git_diff_foreach(Difference, DiffSummaryCallback, nullptr, nullptr, nullptr, nullptr);
+
+    git_diff_free(Difference);
+    git_tree_free(OldTree);
+    git_tree_free(NewTree);
+    git_commit_free(OldCommit);
+    git_commit_free(NewCommit);
+}
+
+std::string GetRemoteDefaultBranch(const std::string &URL, GitOperation &Operation)
+{
+    git_remote *Remote = nullptr;
+    git_remote_callbacks Callbacks = GIT_REMOTE_CALLBACKS_INIT;
+    git_buf Buffer = GIT_BUF_INIT;
+    std::string Branch;
+
+    // A remote whose HEAD is not a branch sets no error of its own.
+    git_error_clear();
+    SetupRemoteCallbacks(Callbacks, &Operation);
+
+    if (git_remote_create_detached(&Remote, URL.c_str()) == 0 &&
+        git_remote_connect(Remote, GIT_DIRECTION_FETCH, &Callbacks, nullptr, nullptr) == 0 &&
+        git_remote_default_branch(&Buffer, Remote) == 0 && strncmp(Buffer.ptr, "refs/heads/", 11) == 0)
+        Branch = Buffer.ptr + 11;
+
+    git_buf_dispose(&Buffer);
+    git_remote_free(Remote);
+
+    return Branch;
+}
+
+int CreateSingleBranchRemote(git_remote **Out, git_repository *Repository, const char *Name, const char *URL,
+                             void *Payload)
+{
+    const std::string &Branch = *(const std::string *)Payload;
+    std::string RefSpec = "+refs/heads/" + Branch + ":refs/remotes/" + Name + "/" + Branch;
+
+    // Written to the config, so plain fetches of this repository stay narrowed too.
+    return git_remote_create_with_fetchspec(Out, Repository, Name, URL, RefSpec.c_str());
+}
+
+// git_clone only takes a missing or empty directory and always fetches, so an existing directory or a clone that
+// borrows from a mirror gets a repository initialized in place. With a mirror the objects come through alternates
+// and only the branches are copied, otherwise origin is fetched. Branch is resolved to the remote's default branch
+// when empty.
+static int CloneInto(git_repository **Out, const std::string &URL, const std::string &Path, bool Bare,
+                     std::string &Branch, bool SingleBranch, git_fetch_options &FetchOptions, const std::string &Mirror,
+                     GitOperation &Operation)
+{
+    std::error_code ErrorCode;
+    std::filesystem::path GitDirectory = Bare ? std::filesystem::path(Path) : std::filesystem::path(Path) / ".git";
+
+    if (std::filesystem::exists(std::filesystem::symlink_status(GitDirectory, ErrorCode)))
+    {
+        git_error_set_str(GIT_ERROR_INVALID, ("'" + Path + "' already contains a repository").c_str());
+        return GIT_EEXISTS;
+    }
+
+    if (Branch.empty())
+        Branch = GetRemoteDefaultBranch(URL, Operation);
+
+    if (Branch.empty())
+    {
+        git_error_set_str(GIT_ERROR_NET, ("Failed to find the default branch of '" + URL + "'").c_str());
+        return -1;
+    }
+
+    git_repository *Repository = nullptr;
+    git_remote *Remote = nullptr;
+    git_reference *Local = nullptr;
+    git_oid Head;
+    std::string BranchRef = "refs/heads/" + Branch;
+
+    int Error = git_repository_init(&Repository, Path.c_str(), Bare ? 1 : 0);
+
+    if (Error == 0)
+        Error = SingleBranch ? CreateSingleBranchRemote(&Remote, Repository, "origin", URL.c_str(), &Branch)
+                             : git_remote_create(&Remote, Repository, "origin", URL.c_str());
+
+    if (Error == 0 && !Mirror.empty() && (Error = Reference::Attach(Repository, Mirror)) == 0)
+        Error = Reference::Sync(Repository, Mirror);
+    else if (Error == 0 && Mirror.empty())
+        Error = git_remote_fetch(Remote, nullptr, &FetchOptions, "clone: in place");
+
+    if (Error == 0)
+        Error = git_reference_name_to_id(&Head, Repository, ("refs/remotes/origin/" + Branch).c_str());
+
+    if (Error == 0)
+        Error = git_reference_create(&Local, Repository, BranchRef.c_str(), &Head, 0, "clone: in place");
+
+    if (Error == 0)
+        Error = git_branch_set_upstream(Local, ("origin/" + Branch).c_str());
 
-    size_t Count = git_diff_num_deltas(Difference);
+    if (Error == 0)
+        Error = git_repository_set_head(Repository, BranchRef.c_str());
 
-    git_oid_tostr(A, sizeof(A), &OldOid);
-    git_oid_tostr(B, sizeof(B), &NewOid);
-    Git::Logger::Log(Git::Logger::Info("Updating {yellow}%s{white}..{yellow}%s"), A, B);
+    git_reference_free(Local);
+    git_remote_free(Remote);
 
-    if (Count > 200)
-        Git::Logger::Log(Git::Logger::Info("Fast-forward"));
-    else
-        git_diff_foreach(Difference, DiffSummaryCallback, nullptr, nullptr, nullptr, nullptr);
+    if (Error != 0)
+    {
+        git_repository_free(Repository);
+        std::filesystem::remove_all(GitDirectory, ErrorCode);
 
-    git_diff_free(Difference);
-    git_tree_free(OldTree);
-    git_tree_free(NewTree);
-    git_commit_free(OldCommit);
-    git_commit_free(NewCommit);
+        return Error;
+    }
+
+    *Out = Repository;
+
+    return 0;
 }
 
-void CopyFilesInto(const std::filesystem::path &Source, const std::filesystem::path &Destination)
+// Writes the whole HEAD tree of a fresh clone as one staged update from the empty tree.
+static int CheckoutClone(git_repository *Repository, const std::string &ClonePath, GitOperation &Operation)
 {
-    for (const auto &Entry : std::filesystem::recursive_directory_iterator(Source))
-    {
-        std::filesystem::path EntryPath = Entry.path();
+    git_oid HeadOid, Applied;
+    git_oid Empty{};
+    std::string BranchRef;
 
-        std::filesystem::path RelativePath = std::filesystem::relative(EntryPath, Source);
-        std::filesystem::path DestinationPath = Destination / RelativePath;
-        std::error_code ErrorCode;
-
-        if (Entry.is_directory())
-        {
-            std::filesystem::create_directories(DestinationPath, ErrorCode);
-            continue;
-        }
+    // An empty remote has nothing to write.
+    if (git_reference_name_to_id(&HeadOid, Repository, "HEAD") != 0)
+        return 0;
 
-        std::filesystem::create_directories(DestinationPath.parent_path(), ErrorCode);
+    if (Stage::Prepare(Repository, ClonePath, Empty, HeadOid, BranchRef, false, Operation) !=
+        GitCodes::PREPARE_SUCCESS)
+        return -1;
 
-        std::filesystem::copy_file(EntryPath, DestinationPath,
-                                   std::filesystem::copy_options::overwrite_existing |
-                                       std::filesystem::copy_options::copy_symlinks,
-                                   ErrorCode);
-    }
+    return Stage::Apply(Repository, ClonePath, Applied, BranchRef) == GitCodes::FAST_FORWARD_SUCCESS ? 0 : -1;
 }
 
-void HandleGitClone(std::string URL, std::string Directory, std::string Path, std::string TempPath, std::string Token)
+void HandleGitClone(std::string URL, std::string Directory, std::string Path, GitCloneOptions CloneOptions,
+                    GitOperation &Operation)
 {
     Logger::Log(Logger::Info("Cloning repository {cyan}%s{white} to {yellow}%s{white}..."), URL.c_str(), Path.c_str());
 
     git_repository *Repository = nullptr;
     git_clone_options Options = GIT_CLONE_OPTIONS_INIT;
 
-    Options.fetch_opts.callbacks.transfer_progress = OnCloneFetchTransferProgress;
-    Options.checkout_opts.progress_cb = OnCloneCheckoutProgress;
-    Options.checkout_opts.progress_payload = nullptr;
-    Options.fetch_opts.callbacks.certificate_check = CertificateCheck;
+    SetupRemoteCallbacks(Options.fetch_opts.callbacks, &Operation);
+    SetupCheckoutCallbacks(Options.checkout_opts, &Operation);
+    Options.fetch_opts.depth = CloneOptions.Depth;
 
-    if (!Token.empty())
+    std::string Branch = CloneOptions.Branch;
+
+    if (CloneOptions.SingleBranch && Branch.empty())
+        Branch = GetRemoteDefaultBranch(URL, Operation);
+
+    // Cloning every branch instead would quietly ignore what was asked for.
+    if (CloneOptions.SingleBranch && Branch.empty())
+    {
+        Operation.Result.Code = GitCodes::CLONE_FAILED;
+        Operation.Result.Error = "Failed to find the default branch of '" + URL + "': " + GetLastErrorMessage();
+
+        Logger::Log(Logger::Error("Failed to clone repository {cyan}%s{white} to {yellow}%s{white}: {red}%s"),
+                    URL.c_str(), Path.c_str(), Operation.Result.Error.c_str());
+        return;
+    }
+
+    if (!Branch.empty())
+        Options.checkout_branch = Branch.c_str();
+
+    if (CloneOptions.SingleBranch && !Branch.empty())
+    {
+        Options.remote_cb = CreateSingleBranchRemote;
+        Options.remote_cb_payload = &Branch;
+    }
+
+    // Deployments keep a bare repository in the destination and write their files themselves.
+    bool Deployment = !CloneOptions.Sparse.Patterns.empty() || !CloneOptions.Sparse.Root.empty();
+    std::string ClonePath = Deployment ? (std::filesystem::path(Path) / ".git").string() : Path;
+    std::error_code ErrorCode;
+    bool Existed = std::filesystem::exists(Path, ErrorCode);
+
+    Options.bare = Deployment ? 1 : 0;
+
+    // The files are written by the parallel checkout below instead of libgit2's single threaded one.
+    Options.checkout_opts.checkout_strategy = GIT_CHECKOUT_NONE;
+
+    int Error = 0;
+    std::string Mirror;
+
+    // The mirror fetches the full history, so a reference clone is never shallow.
+    if (!CloneOptions.Reference.empty())
     {
-        const char *TokenPtr = Token.c_str();
-        Options.fetch_opts.callbacks.credentials = CredentialToken;
-        Options.fetch_opts.callbacks.payload = (void *)TokenPtr;
+        Mirror = Reference::Mirror(CloneOptions.Reference, URL);
+
+        if (Reference::Update(Mirror, URL, Options.fetch_opts, CloneOptions.SingleBranch ? Branch : "") == 0)
+            CloneOptions.Depth = 0;
+        else
+        {
+            Logger::Log(Logger::Info("Failed to update the reference mirror {yellow}%s{white}: {red}%s"),
+                        Mirror.c_str(), GetLastErrorMessage().c_str());
+            Mirror.clear();
+        }
+    }
+
+    if (!Mirror.empty())
+        Error = CloneInto(&Repository, URL, ClonePath, Deployment, Branch, CloneOptions.SingleBranch,
+                          Options.fetch_opts, Mirror, Operation);
+    else if (CloneOptions.Blobless && Promisor::IsLocal(URL))
+        Error = Promisor::Clone(&Repository, URL, ClonePath, Deployment, Branch, CloneOptions.SingleBranch);
+    else
+    {
+        // libgit2 has no way to ask a server for a filtered pack.
+        if (CloneOptions.Blobless)
+            Logger::Log(Logger::Info("Blobless clones need a local remote, cloning {cyan}%s{white} in full."),
+                        URL.c_str());
+
+        if (!Deployment && Existed && !std::filesystem::is_empty(Path, ErrorCode))
+            Error = CloneInto(&Repository, URL, Path, false, Branch, CloneOptions.SingleBranch, Options.fetch_opts,
+                              std::string(), Operation);
+        else
+            Error = git_clone(&Repository, URL.c_str(), ClonePath.c_str(), &Options);
     }
 
-    int Error = git_clone(&Repository, URL.c_str(), TempPath.c_str(), &Options);
+    // Set before the checkout, so even the first one links its files from the store.
+    if (Error == 0 && !CloneOptions.Store.empty() && !Store::Configure(Repository, CloneOptions.Store))
+        Logger::Log(Logger::Info("Failed to use the blob store {yellow}%s{white}, writing files directly."),
+                    CloneOptions.Store.c_str());
+
+    if (Error == 0 && !Deployment)
+        Error = CheckoutClone(Repository, Path, Operation);
 
     if (Error != 0)
     {
-        const git_error *ErrorStack = git_error_last();
+        Operation.Result.Code = GitCodes::CLONE_FAILED;
+        Operation.Result.Error = GetLastErrorMessage();
 
         Logger::Log(Logger::Error("Failed to clone repository {cyan}%s{white} to {yellow}%s{white}: {red}%s"),
-                    URL.c_str(), Path.c_str(),
-                    (ErrorStack && ErrorStack->message) ? ErrorStack->message : "Unknown error");
+                    URL.c_str(), Path.c_str(), Operation.Result.Error.c_str());
+
+        // Only the checkout is left to fail here, the clone steps clean up after themselves. In an existing
+        // directory only the repository goes: tracked files the checkout already replaced are not restored.
+        if (!Deployment && Repository)
+            std::filesystem::remove_all(Existed ? std::filesystem::path(Path) / ".git" : std::filesystem::path(Path),
+                                        ErrorCode);
 
         git_repository_free(Repository);
 
         return;
     }
 
-    git_repository_free(Repository);
+    git_oid HeadOid;
+
+    if (git_reference_name_to_id(&HeadOid, Repository, "HEAD") == 0)
+        Operation.Result.NewOid = git_oid_tostr_s(&HeadOid);
+
+    git_config *Config = nullptr;
+
+    if (CloneOptions.Atomic && git_repository_config(&Config, Repository) == 0)
+        git_config_set_bool(Config, GIT_ATOMIC_CONFIG, true);
+
+    git_config_free(Config);
 
-    if (!std::filesystem::exists(Path))
+    if (Deployment)
     {
-        std::filesystem::rename(TempPath, Path);
+        HandleGitDeploy(URL, Path, CloneOptions.Sparse, Repository, Operation);
+        git_repository_free(Repository);
+        Cache::Invalidate(Path);
+        return;
     }
-    else
+
+    git_repository_free(Repository);
+    Cache::Invalidate(Path);
+
+    Operation.Result.Code = GitCodes::CLONE_SUCCESS;
+    Logger::Log(Logger::Success("Repository cloned successfully {cyan}%s{white} to {yellow}%s{white}."), URL.c_str(),
+                Path.c_str());
+}
+
+void HandleGitDeploy(const std::string &URL, const std::string &Path, const GitSparseOptions &Deployment,
+                     git_repository *Repository, GitOperation &Operation)
+{
+    git_checkout_options CheckoutOptions = GIT_CHECKOUT_OPTIONS_INIT;
+    git_oid HeadOid;
+    git_commit *HeadCommit = nullptr;
+    git_tree *HeadTree = nullptr;
+
+    Sparse::Save(Repository, Deployment);
+    SetupCheckoutCallbacks(CheckoutOptions, &Operation);
+
+    // Overwrites files already in the destination, like the copy of a regular clone does.
+    CheckoutOptions.checkout_strategy = GIT_CHECKOUT_FORCE;
+
+    int Error = git_reference_name_to_id(&HeadOid, Repository, "HEAD");
+
+    if (Error == 0)
+        Error = git_commit_lookup(&HeadCommit, Repository, &HeadOid);
+
+    if (Error == 0)
+        Error = git_commit_tree(&HeadTree, HeadCommit);
+
+    if (Error == 0)
+        Error = Sparse::Write(Repository, Path, Deployment, HeadTree, nullptr, CheckoutOptions);
+
+    git_tree_free(HeadTree);
+    git_commit_free(HeadCommit);
+
+    if (Error != 0)
     {
-        Logger::Log(Logger::Info("Copying files into {cyan}%s{white}..."), Path.c_str());
-        CopyFilesInto(TempPath, Path);
-        std::filesystem::remove_all(TempPath);
+        Operation.Result.Code = GitCodes::CLONE_FAILED;
+        Operation.Result.Error = GetLastErrorMessage();
+
+        Logger::Log(Logger::Error("Failed to write deployment {yellow}%s{white}: {red}%s"), Path.c_str(),
+                    Operation.Result.Error.c_str());
+
+        return;
     }
 
-    Logger::Log(Logger::Success("Repository cloned successfully {cyan}%s{white} to {yellow}%s{white}."), URL.c_str(),
+    Operation.Result.Code = GitCodes::CLONE_SUCCESS;
+    Logger::Log(Logger::Success("Repository deployed successfully {cyan}%s{white} to {yellow}%s{white}."), URL.c_str(),
                 Path.c_str());
 }
 
-void HandleGitPull(std::string Directory, std::string Path, std::string Token)
+// Applies new sparse patterns before a Pull or Checkout, returns false when the operation should stop.
+static bool ApplySparsePatterns(GitRepository &Repository, const std::string &Path,
+                                const std::optional<std::vector<std::string>> &Sparse, GitOperation &Operation)
+{
+    if (!Sparse)
+        return true;
+
+    GitCodes Code = Repository.SetSparse(*Sparse);
+
+    if (GitCodeSucceeded(Code))
+        return true;
+
+    Operation.Result.Code = Code;
+    Operation.Result.Error = Code == GitCodes::NOT_A_DEPLOYMENT ? "Sparse patterns need a deployment clone"
+                                                                : GetLastErrorMessage();
+
+    Logger::Log(Logger::Error("Failed to update sparse patterns of {cyan}%s{white}: {red}%s"), Path.c_str(),
+                Operation.Result.Error.c_str());
+
+    return false;
+}
+
+void HandleGitPull(std::string Directory, std::string Path, std::optional<std::vector<std::string>> Sparse,
+                   GitOperation &Operation)
 {
-    GitRepository Repository(Path, Token);
+    GitRepository Repository(Path, Operation.Token, &Operation);
 
     if (!Repository.Valid())
     {
         Logger::Log(Logger::Error("Not a valid Git repository {cyan}%s{white}."), Path.c_str());
+        Operation.Result.Code = GitCodes::REPOSITORY_OPEN_FAILED;
         return;
     }
 
+    Operation.Result.OldOid = Repository.GetHash();
+
+    if (!ApplySparsePatterns(Repository, Path, Sparse, Operation))
+        return;
+
     GitCodes Code = Repository.Pull();
 
+    Operation.Result.Code = Code;
+
+    if (!GitCodeSucceeded(Code))
+        Operation.Result.Error = GetLastErrorMessage();
+
+    Operation.Result.NewOid = Repository.GetHash();
+
+    // Sparse patterns change the working tree on their own.
+    if (!Sparse)
+        TrackChanges(Repository.GetRepository(), Operation);
+
     switch (Code)
     {
     case GitCodes::FAST_FORWARD_SUCCESS: {
@@ -507,18 +1445,35 @@ void HandleGitPull(std::string Directory, std::string Path, std::string Token)
     }
 }
 
-void HandleGitCheckout(std::string Directory, std::string Path, std::string Head, std::string Token)
+void HandleGitCheckout(std::string Directory, std::string Path, std::string Head,
+                       std::optional<std::vector<std::string>> Sparse, GitOperation &Operation)
 {
-    GitRepository Repository(Path, Token);
+    GitRepository Repository(Path, Operation.Token, &Operation);
 
     if (!Repository.Valid())
     {
         Logger::Log(Logger::Error("Not a valid Git repository {cyan}%s{white}."), Path.c_str());
+        Operation.Result.Code = GitCodes::REPOSITORY_OPEN_FAILED;
         return;
     }
 
+    Operation.Result.OldOid = Repository.GetHash();
+
+    if (!ApplySparsePatterns(Repository, Path, Sparse, Operation))
+        return;
+
     GitCodes Code = Repository.Checkout(Head);
 
+    Operation.Result.Code = Code;
+
+    if (!GitCodeSucceeded(Code))
+        Operation.Result.Error = GetLastErrorMessage();
+
+    Operation.Result.NewOid = Repository.GetHash();
+
+    if (!Sparse)
+        TrackChanges(Repository.GetRepository(), Operation);
+
     switch (Code)
     {
     case GitCodes::CHECKOUT_SUCCESS: {
@@ -553,18 +1508,113 @@ void HandleGitCheckout(std::string Directory, std::string Path, std::string Head
     }
 }
 
-void HandleGitAdd(std::string Directory, std::string Path, std::string File, std::string Token)
+void HandleGitPrepare(std::string Directory, std::string Path, GitOperation &Operation)
+{
+    GitRepository Repository(Path, Operation.Token, &Operation);
+
+    if (!Repository.Valid())
+    {
+        Logger::Log(Logger::Error("Not a valid Git repository {cyan}%s{white}."), Path.c_str());
+        Operation.Result.Code = GitCodes::REPOSITORY_OPEN_FAILED;
+        return;
+    }
+
+    Operation.Result.OldOid = Repository.GetHash();
+    Operation.Result.Code = Repository.Prepare();
+    Operation.Result.NewOid = Repository.GetHash();
+    Operation.Touched.emplace();
+
+    if (Operation.Result.Code == GitCodes::PREPARE_SUCCESS)
+        Logger::Log(Logger::Success("Update of {cyan}%s{white} prepared, apply it with git.Apply."), Path.c_str());
+    else if (Operation.Result.Code == GitCodes::UP_TO_DATE)
+        Logger::Log(Logger::Success("Repository {cyan}%s{white} up to date."), Path.c_str());
+    else
+    {
+        Operation.Result.Error = GetLastErrorMessage();
+        Logger::Log(Logger::Error("Failed to prepare {cyan}%s{white}: {red}%s"), Path.c_str(),
+                    Operation.Result.Error.c_str());
+    }
+}
+
+void HandleGitApply(std::string Directory, std::string Path, GitOperation &Operation)
+{
+    GitRepository Repository(Path, Operation.Token, &Operation);
+
+    if (!Repository.Valid())
+    {
+        Logger::Log(Logger::Error("Not a valid Git repository {cyan}%s{white}."), Path.c_str());
+        Operation.Result.Code = GitCodes::REPOSITORY_OPEN_FAILED;
+        return;
+    }
+
+    Operation.Result.OldOid = Repository.GetHash();
+    Operation.Result.Code = Repository.Apply();
+    Operation.Result.NewOid = Repository.GetHash();
+    TrackChanges(Repository.GetRepository(), Operation);
+
+    if (Operation.Result.Code == GitCodes::FAST_FORWARD_SUCCESS)
+        Logger::Log(Logger::Success("Repository {cyan}%s{white} fast-forwarded."), Path.c_str());
+    else if (Operation.Result.Code == GitCodes::NOTHING_PREPARED)
+        Operation.Result.Error = "No update was prepared for this repository";
+    else
+    {
+        Operation.Result.Error = GetLastErrorMessage();
+        Logger::Log(Logger::Error("Failed to apply the prepared update of {cyan}%s{white}: {red}%s"), Path.c_str(),
+                    Operation.Result.Error.c_str());
+    }
+}
+
+void HandleGitRollback(std::string Directory, std::string Path, int Steps, GitOperation &Operation)
+{
+    GitRepository Repository(Path, Operation.Token, &Operation);
+
+    if (!Repository.Valid())
+    {
+        Logger::Log(Logger::Error("Not a valid Git repository {cyan}%s{white}."), Path.c_str());
+        Operation.Result.Code = GitCodes::REPOSITORY_OPEN_FAILED;
+        return;
+    }
+
+    Operation.Result.OldOid = Repository.GetHash();
+    Operation.Result.Code = Repository.Rollback(Steps, Operation.Result.Files);
+    Operation.Result.NewOid = Repository.GetHash();
+    TrackChanges(Repository.GetRepository(), Operation);
+
+    if (Operation.Result.Code == GitCodes::ROLLBACK_SUCCESS)
+    {
+        Logger::Log(Logger::Success("Rolled {cyan}%s{white} back to {yellow}%s{white}, %d files changed."), Path.c_str(),
+                    Repository.GetShortHash().c_str(), (int)Operation.Result.Files.size());
+        return;
+    }
+
+    Operation.Result.Files.clear();
+    Operation.Result.Error = GetLastErrorMessage();
+    Logger::Log(Logger::Error("Failed to roll back {cyan}%s{white}: {red}%s"), Path.c_str(),
+                Operation.Result.Error.c_str());
+}
+
+void HandleGitAdd(std::string Directory, std::string Path, std::string File, GitOperation &Operation)
 {
-    GitRepository Repository(Path, Token);
+    GitRepository Repository(Path, Operation.Token, &Operation);
 
     if (!Repository.Valid())
     {
         Logger::Log(Logger::Error("Not a valid Git repository {cyan}%s{white}."), Path.c_str());
+        Operation.Result.Code = GitCodes::REPOSITORY_OPEN_FAILED;
         return;
     }
 
+    Operation.Result.OldOid = Repository.GetHash();
+
     GitCodes Code = Repository.Add(File, Path);
 
+    Operation.Result.Code = Code;
+
+    if (!GitCodeSucceeded(Code))
+        Operation.Result.Error = GetLastErrorMessage();
+
+    Operation.Result.NewOid = Repository.GetHash();
+
     switch (Code)
     {
     case GitCodes::ADD_SUCCESS: {
@@ -599,18 +1649,29 @@ void HandleGitAdd(std::string Directory, std::string Path, std::string File, std
 }
 
 void HandleGitCommit(std::string Directory, std::string Path, std::string Message, std::string AuthorName,
-                     std::string AuthorEmail, std::string Token)
+                     std::string AuthorEmail, GitOperation &Operation)
 {
-    GitRepository Repository(Path, Token);
+    GitRepository Repository(Path, Operation.Token, &Operation);
 
     if (!Repository.Valid())
     {
         Logger::Log(Logger::Error("Not a valid Git repository {cyan}%s{white}."), Path.c_str());
+        Operation.Result.Code = GitCodes::REPOSITORY_OPEN_FAILED;
         return;
     }
 
+    Operation.Result.OldOid = Repository.GetHash();
+
     GitCodes Code = Repository.Commit(Message, AuthorName, AuthorEmail);
 
+    Operation.Result.Code = Code;
+    Operation.Touched.emplace();
+
+    if (!GitCodeSucceeded(Code))
+        Operation.Result.Error = GetLastErrorMessage();
+
+    Operation.Result.NewOid = Repository.GetHash();
+
     switch (Code)
     {
     case GitCodes::COMMIT_SUCCESS: {
@@ -644,18 +1705,29 @@ void HandleGitCommit(std::string Directory, std::string Path, std::string Messag
     }
 }
 
-void HandleGitPush(std::string Directory, std::string Path, std::string Token)
+void HandleGitPush(std::string Directory, std::string Path, GitOperation &Operation)
 {
-    GitRepository Repository(Path, Token);
+    GitRepository Repository(Path, Operation.Token, &Operation);
 
     if (!Repository.Valid())
     {
         Logger::Log(Logger::Error("Not a valid Git repository {cyan}%s{white}."), Path.c_str());
+        Operation.Result.Code = GitCodes::REPOSITORY_OPEN_FAILED;
         return;
     }
 
+    Operation.Result.OldOid = Repository.GetHash();
+
     GitCodes Code = Repository.Push();
 
+    Operation.Result.Code = Code;
+    Operation.Touched.emplace();
+
+    if (!GitCodeSucceeded(Code))
+        Operation.Result.Error = GetLastErrorMessage();
+
+    Operation.Result.NewOid = Repository.GetHash();
+
     switch (Code)
     {
     case GitCodes::NOTHING_TO_PUSH: {
@@ -688,4 +1760,164 @@ void HandleGitPush(std::string Directory, std::string Path, std::string Token)
     }
     }
 }
-} // namespace Git::Functions
\ No newline at end of file
+
+void HandleGitDescribe(std::string Directory, std::string Path, GitOperation &Operation)
+{
+    std::shared_ptr<const GitSnapshot> State = RefreshSnapshot(Path);
+
+    if (!State)
+    {
+        Logger::Log(Logger::Error("Not a valid Git repository {cyan}%s{white}."), Path.c_str());
+        Operation.Result.Code = GitCodes::REPOSITORY_OPEN_FAILED;
+        return;
+    }
+
+    Operation.Result.Code = GitCodes::DESCRIBE_SUCCESS;
+    Operation.Result.NewOid = State->Hash;
+    Operation.Result.Snapshot = State;
+}
+
+void HandleGitCheckRemote(std::string Directory, std::string Path, GitOperation &Operation)
+{
+    GitRepository Repository(Path, Operation.Token, &Operation);
+
+    if (!Repository.Valid())
+    {
+        Logger::Log(Logger::Error("Not a valid Git repository {cyan}%s{white}."), Path.c_str());
+        Operation.Result.Code = GitCodes::REPOSITORY_OPEN_FAILED;
+        return;
+    }
+
+    Operation.Result.OldOid = Repository.GetHash();
+    Operation.Result.Code = Repository.CheckRemote(Operation.Result.NewOid);
+
+    switch (Operation.Result.Code)
+    {
+    case GitCodes::REMOTE_UP_TO_DATE:
+        break;
+    case GitCodes::REMOTE_CHANGED: {
+        Logger::Log(Logger::Info("Repository {cyan}%s{white} has upstream changes."), Path.c_str());
+        break;
+    }
+    default: {
+        Operation.Result.Error = GetLastErrorMessage();
+        Logger::Log(Logger::Error("Failed to check remote {cyan}%s{white}: {red}%s"), Path.c_str(),
+                    Operation.Result.Error.c_str());
+        break;
+    }
+    }
+}
+
+void HandleGitDeepen(std::string Directory, std::string Path, int Depth, GitOperation &Operation)
+{
+    GitRepository Repository(Path, Operation.Token, &Operation);
+
+    if (!Repository.Valid())
+    {
+        Logger::Log(Logger::Error("Not a valid Git repository {cyan}%s{white}."), Path.c_str());
+        Operation.Result.Code = GitCodes::REPOSITORY_OPEN_FAILED;
+        return;
+    }
+
+    Operation.Result.OldOid = Repository.GetHash();
+    Operation.Result.Code = Repository.Deepen(Depth);
+    Operation.Result.NewOid = Repository.GetHash();
+    Operation.Touched.emplace();
+
+    if (!GitCodeSucceeded(Operation.Result.Code))
+    {
+        Operation.Result.Error = GetLastErrorMessage();
+        Logger::Log(Logger::Error("Failed to deepen {cyan}%s{white}: {red}%s"), Path.c_str(),
+                    Operation.Result.Error.c_str());
+        return;
+    }
+
+    if (Depth > 0)
+        Logger::Log(Logger::Success("Repository {cyan}%s{white} now has a depth of {yellow}%d{white}."), Path.c_str(),
+                    Depth);
+    else
+        Logger::Log(Logger::Success("Repository {cyan}%s{white} now has its full history."), Path.c_str());
+}
+
+void HandleMeasureCopy(std::string Source, std::string Destination, bool HardLink, GitOperation &Operation)
+{
+    Copy::Measurement Times;
+
+    if (!Copy::Measure(Source, Destination, HardLink, Times))
+    {
+        Operation.Result.Code = GitCodes::COPY_FAILED;
+        Operation.Result.Error = "Failed to copy '" + Source + "' to '" + Destination + "'";
+
+        Logger::Log(Logger::Error("Failed to measure a copy of {cyan}%s{white} to {yellow}%s{white}."),
+                    Source.c_str(), Destination.c_str());
+        return;
+    }
+
+    Operation.Result.Code = GitCodes::COPY_MEASURED;
+    Operation.Result.Numbers = {{"Seconds", Times.Seconds},
+                                {"SerialSeconds", Times.SerialSeconds},
+                                {"FileCount", (double)Times.Files},
+                                {"Bytes", (double)Times.Bytes}};
+
+    Logger::Log(Logger::Success("Copied {yellow}%zu{white} files of {cyan}%s{white} in {yellow}%.3f{white}s, the serial "
+                                "copy took {yellow}%.3f{white}s."),
+                Times.Files, Source.c_str(), Times.Seconds, Times.SerialSeconds);
+}
+
+void HandleSetAtomic(std::string Directory, std::string Path, bool Atomic, GitOperation &Operation)
+{
+    GitRepository Repository(Path, std::string());
+
+    if (!Repository.Valid())
+    {
+        Logger::Log(Logger::Error("Not a valid Git repository {cyan}%s{white}."), Path.c_str());
+        Operation.Result.Code = GitCodes::REPOSITORY_OPEN_FAILED;
+        return;
+    }
+
+    if (!Repository.SetAtomic(Atomic))
+    {
+        Operation.Result.Code = GitCodes::CONFIG_FAILED;
+        Operation.Result.Error = GetLastErrorMessage();
+        Logger::Log(Logger::Error("Failed to set the deployment mode of {cyan}%s{white}: {red}%s"), Path.c_str(),
+                    Operation.Result.Error.c_str());
+        return;
+    }
+
+    Operation.Result.Code = GitCodes::CONFIG_SUCCESS;
+}
+
+void HandleSetBlobStore(std::string Directory, std::string Path, std::string BlobStore, GitOperation &Operation)
+{
+    GitRepository Repository(Path, std::string());
+
+    if (!Repository.Valid())
+    {
+        Logger::Log(Logger::Error("Not a valid Git repository {cyan}%s{white}."), Path.c_str());
+        Operation.Result.Code = GitCodes::REPOSITORY_OPEN_FAILED;
+        return;
+    }
+
+    if (!Store::Configure(Repository.GetRepository(), BlobStore))
+    {
+        Operation.Result.Code = GitCodes::CONFIG_FAILED;
+        Operation.Result.Error = GetLastErrorMessage();
+        Logger::Log(Logger::Error("Failed to set the blob store of {cyan}%s{white}: {red}%s"), Path.c_str(),
+                    Operation.Result.Error.c_str());
+        return;
+    }
+
+    Operation.Result.Code = GitCodes::CONFIG_SUCCESS;
+}
+
+void HandlePruneBlobStore(std::string BlobStore, GitOperation &Operation)
+{
+    size_t Removed = Store::Prune(BlobStore);
+
+    Operation.Result.Code = GitCodes::PRUNE_SUCCESS;
+    Operation.Result.Numbers = {{"Removed", (double)Removed}};
+
+    Logger::Log(Logger::Success("Removed {yellow}%zu{white} unused files from {cyan}%s{white}."), Removed,
+                BlobStore.c_str());
+}
+} // namespace Git::Functions
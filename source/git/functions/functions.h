@@ -1,33 +1,92 @@
 #pragma once
 #include "../includes.h"
 #include "../git/git.h"
+#include "../dispatcher/dispatcher.h"
+#include "../operation/operation.h"
+#include "../snapshot/snapshot.h"
 
 namespace Git::Functions
 {
 int Clone(lua_State *L);
 int Pull(lua_State *L);
 int Checkout(lua_State *L);
+int Prepare(lua_State *L);
+int Apply(lua_State *L);
+int Rollback(lua_State *L);
+int GetHistory(lua_State *L);
 int Add(lua_State *L);
 int Commit(lua_State *L);
 int Push(lua_State *L);
 int GetBranch(lua_State *L);
 int GetShortHash(lua_State *L);
+int Describe(lua_State *L);
+int DescribeAsync(lua_State *L);
+int CheckRemote(lua_State *L);
+int AutoUpdate(lua_State *L);
+int StopAutoUpdate(lua_State *L);
+int StartWebhook(lua_State *L);
+int StopWebhook(lua_State *L);
+int Deepen(lua_State *L);
+int SetAtomic(lua_State *L);
+int SetBlobStore(lua_State *L);
+int PruneBlobStore(lua_State *L);
+int MeasureCopy(lua_State *L);
+int SetCallbackBudget(lua_State *L);
+int SetTimeouts(lua_State *L);
+int SetRepositoryCacheSize(lua_State *L);
+int SetWorkerCount(lua_State *L);
+int GetPoolStats(lua_State *L);
 
+std::string StorePath(const std::string &Store);
+GitCloneOptions ParseCloneOptions(GarrysMod::Lua::ILuaBase *LUA, int StackPos);
+std::optional<std::vector<std::string>> ParseSparsePatterns(GarrysMod::Lua::ILuaBase *LUA, int StackPos);
+void Schedule(GarrysMod::Lua::ILuaBase *LUA, const std::string &Path, const std::string &Token, int Callback,
+              std::function<void(GitOperation &)> Handler, bool RefreshAfter = true);
+std::shared_ptr<const GitSnapshot> RefreshSnapshot(const std::string &Path,
+                                                   const std::vector<std::string> *Touched = nullptr);
+void TrackChanges(git_repository *Repository, GitOperation &Operation);
+void OnRefsChanged(const std::string &Path);
+std::shared_ptr<const GitSnapshot> GetSnapshot(const std::string &Path);
+std::string GetLastErrorMessage();
 std::string Pastelize(const std::string& Text);
 void FormatString(char *Buffer, const char *Format, ...);
 std::string ProgressBar(double Percent);
 bool ShouldLogPercent(int PercentInt, int &LastPercent);
-int OnCloneFetchTransferProgress(const git_indexer_progress *Progress, void *);
-void OnCloneCheckoutProgress(const char *Path, size_t CompletedSteps, size_t TotalSteps, void *);
+int OnCloneFetchTransferProgress(const git_indexer_progress *Progress, void *Payload);
+int OnPushTransferProgress(unsigned int Current, unsigned int Total, size_t Bytes, void *Payload);
+void OnCloneCheckoutProgress(const char *Path, size_t CompletedSteps, size_t TotalSteps, void *Payload);
+int OnRemoteReady(git_remote *, int, void *Payload);
+int OnSidebandProgress(const char *, int, void *Payload);
+int OnCheckoutNotify(git_checkout_notify_t, const char *, const git_diff_file *, const git_diff_file *,
+                     const git_diff_file *, void *Payload);
 int CredentialToken(git_credential **Out, const char *, const char *, unsigned int AllowedTypes, void *Payload);
 int CertificateCheck(git_cert *, int, const char *, void *);
+void SetupRemoteCallbacks(git_remote_callbacks &Callbacks, GitOperation *Operation);
+void SetupCheckoutCallbacks(git_checkout_options &Options, GitOperation *Operation);
 std::string GetGithubAccessToken();
 void PrintGitDiffSummary(git_repository *Repository, const git_oid &OldOid, const git_oid &NewOid);
-void CopyFilesInto(const std::filesystem::path &Source, const std::filesystem::path &Destination);
-void HandleGitClone(std::string URL, std::string Directory, std::string Path, std::string TempPath, std::string Token);
-void HandleGitPull(std::string Directory, std::string Path, std::string Token);
-void HandleGitCheckout(std::string Directory, std::string Path, std::string Head, std::string Token);
-void HandleGitAdd(std::string Directory, std::string Path, std::string File, std::string Token);
-void HandleGitCommit(std::string Directory, std::string Path, std::string Message, std::string AuthorName, std::string AuthorEmail, std::string Token);
-void HandleGitPush(std::string Directory, std::string Path, std::string Token);
+std::string GetRemoteDefaultBranch(const std::string &URL, GitOperation &Operation);
+int CreateSingleBranchRemote(git_remote **Out, git_repository *Repository, const char *Name, const char *URL,
+                             void *Payload);
+void HandleGitClone(std::string URL, std::string Directory, std::string Path, GitCloneOptions CloneOptions,
+                    GitOperation &Operation);
+void HandleGitDeploy(const std::string &URL, const std::string &Path, const GitSparseOptions &Deployment,
+                     git_repository *Repository, GitOperation &Operation);
+void HandleGitPull(std::string Directory, std::string Path, std::optional<std::vector<std::string>> Sparse,
+                   GitOperation &Operation);
+void HandleGitCheckout(std::string Directory, std::string Path, std::string Head,
+                       std::optional<std::vector<std::string>> Sparse, GitOperation &Operation);
+void HandleGitPrepare(std::string Directory, std::string Path, GitOperation &Operation);
+void HandleGitApply(std::string Directory, std::string Path, GitOperation &Operation);
+void HandleGitRollback(std::string Directory, std::string Path, int Steps, GitOperation &Operation);
+void HandleGitAdd(std::string Directory, std::string Path, std::string File, GitOperation &Operation);
+void HandleGitCommit(std::string Directory, std::string Path, std::string Message, std::string AuthorName, std::string AuthorEmail, GitOperation &Operation);
+void HandleGitPush(std::string Directory, std::string Path, GitOperation &Operation);
+void HandleGitDescribe(std::string Directory, std::string Path, GitOperation &Operation);
+void HandleGitCheckRemote(std::string Directory, std::string Path, GitOperation &Operation);
+void HandleGitDeepen(std::string Directory, std::string Path, int Depth, GitOperation &Operation);
+void HandleSetAtomic(std::string Directory, std::string Path, bool Atomic, GitOperation &Operation);
+void HandleSetBlobStore(std::string Directory, std::string Path, std::string BlobStore, GitOperation &Operation);
+void HandlePruneBlobStore(std::string BlobStore, GitOperation &Operation);
+void HandleMeasureCopy(std::string Source, std::string Destination, bool HardLink, GitOperation &Operation);
 } // namespace Git::Functions
\ No newline at end of file
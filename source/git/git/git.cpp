@@ -1,6 +1,14 @@
 #include "git.h"
 #include "../functions/functions.h"
 #include "../logger/logger.h"
+#include "../cache/cache.h"
+#include "../core/core.h"
+#include "../sparse/sparse.h"
+#include "../promisor/promisor.h"
+#include "../stage/stage.h"
+#include "../history/history.h"
+#include "../reference/reference.h"
+#include <git2/sys/errors.h>
 
 class GitRemote
 {
@@ -198,7 +206,11 @@ class GitIndex
         {
             git_index_free(Index);
             Index = nullptr;
+            return;
         }
+
+        // The index object lives as long as the cached repository, so pick up changes made by other handles.
+        git_index_read(Index, 0);
     }
 
     ~GitIndex()
@@ -280,21 +292,173 @@ class GitCommit
     git_commit *Commit;
 };
 
-GitRepository::GitRepository(const std::string &Path, const std::string &Token) : Repository(nullptr), Token(Token)
+const char *GitCodeName(GitCodes Code)
 {
-    int Error = git_repository_open(&Repository, Path.c_str());
+    switch (Code)
+    {
+    case GitCodes::FAST_FORWARD_SUCCESS:
+        return "FAST_FORWARD_SUCCESS";
+    case GitCodes::MERGE_SUCCESS:
+        return "MERGE_SUCCESS";
+    case GitCodes::CHECKOUT_SUCCESS:
+        return "CHECKOUT_SUCCESS";
+    case GitCodes::ADD_SUCCESS:
+        return "ADD_SUCCESS";
+    case GitCodes::COMMIT_SUCCESS:
+        return "COMMIT_SUCCESS";
+    case GitCodes::PUSH_SUCCESS:
+        return "PUSH_SUCCESS";
+    case GitCodes::UP_TO_DATE:
+        return "UP_TO_DATE";
+    case GitCodes::NOTHING_TO_ADD:
+        return "NOTHING_TO_ADD";
+    case GitCodes::NOTHING_TO_COMMIT:
+        return "NOTHING_TO_COMMIT";
+    case GitCodes::NOTHING_TO_PUSH:
+        return "NOTHING_TO_PUSH";
+    case GitCodes::ORIGIN_LOOKUP_FAILED:
+        return "ORIGIN_LOOKUP_FAILED";
+    case GitCodes::REMOTE_FETCH_FAILED:
+        return "REMOTE_FETCH_FAILED";
+    case GitCodes::HEAD_FETCH_FAILED:
+        return "HEAD_FETCH_FAILED";
+    case GitCodes::HEAD_READ_FAILED:
+        return "HEAD_READ_FAILED";
+    case GitCodes::HEAD_LOOKUP_FAILED:
+        return "HEAD_LOOKUP_FAILED";
+    case GitCodes::FAST_FORWARD_FAILED:
+        return "FAST_FORWARD_FAILED";
+    case GitCodes::TREE_LOOKUP_FAILED:
+        return "TREE_LOOKUP_FAILED";
+    case GitCodes::MERGE_CONFLICTS_FOUND:
+        return "MERGE_CONFLICTS_FOUND";
+    case GitCodes::MERGE_FAILED:
+        return "MERGE_FAILED";
+    case GitCodes::TARGET_LOOKUP_FAILED:
+        return "TARGET_LOOKUP_FAILED";
+    case GitCodes::TREE_INDEX_FAILED:
+        return "TREE_INDEX_FAILED";
+    case GitCodes::CHECKOUT_FAILED:
+        return "CHECKOUT_FAILED";
+    case GitCodes::REPOSITORY_INDEX_FAILED:
+        return "REPOSITORY_INDEX_FAILED";
+    case GitCodes::FILE_NOT_FOUND:
+        return "FILE_NOT_FOUND";
+    case GitCodes::ADD_FAILED:
+        return "ADD_FAILED";
+    case GitCodes::COMMIT_FAILED:
+        return "COMMIT_FAILED";
+    case GitCodes::PUSH_FAILED:
+        return "PUSH_FAILED";
+    case GitCodes::CLONE_SUCCESS:
+        return "CLONE_SUCCESS";
+    case GitCodes::CLONE_FAILED:
+        return "CLONE_FAILED";
+    case GitCodes::REPOSITORY_OPEN_FAILED:
+        return "REPOSITORY_OPEN_FAILED";
+    case GitCodes::OPERATION_CANCELLED:
+        return "OPERATION_CANCELLED";
+    case GitCodes::OPERATION_TIMED_OUT:
+        return "OPERATION_TIMED_OUT";
+    case GitCodes::DESCRIBE_SUCCESS:
+        return "DESCRIBE_SUCCESS";
+    case GitCodes::REMOTE_UP_TO_DATE:
+        return "REMOTE_UP_TO_DATE";
+    case GitCodes::REMOTE_CHANGED:
+        return "REMOTE_CHANGED";
+    case GitCodes::REMOTE_CONNECT_FAILED:
+        return "REMOTE_CONNECT_FAILED";
+    case GitCodes::REMOTE_BRANCH_NOT_FOUND:
+        return "REMOTE_BRANCH_NOT_FOUND";
+    case GitCodes::FETCH_SUCCESS:
+        return "FETCH_SUCCESS";
+    case GitCodes::NOT_FAST_FORWARD:
+        return "NOT_FAST_FORWARD";
+    case GitCodes::BRANCH_MISMATCH:
+        return "BRANCH_MISMATCH";
+    case GitCodes::NOT_A_DEPLOYMENT:
+        return "NOT_A_DEPLOYMENT";
+    case GitCodes::PREPARE_SUCCESS:
+        return "PREPARE_SUCCESS";
+    case GitCodes::NOTHING_PREPARED:
+        return "NOTHING_PREPARED";
+    case GitCodes::PREPARED_STATE_CHANGED:
+        return "PREPARED_STATE_CHANGED";
+    case GitCodes::ROLLBACK_SUCCESS:
+        return "ROLLBACK_SUCCESS";
+    case GitCodes::ROLLBACK_UNAVAILABLE:
+        return "ROLLBACK_UNAVAILABLE";
+    case GitCodes::COPY_MEASURED:
+        return "COPY_MEASURED";
+    case GitCodes::COPY_FAILED:
+        return "COPY_FAILED";
+    case GitCodes::CONFIG_SUCCESS:
+        return "CONFIG_SUCCESS";
+    case GitCodes::CONFIG_FAILED:
+        return "CONFIG_FAILED";
+    case GitCodes::PRUNE_SUCCESS:
+        return "PRUNE_SUCCESS";
+    }
 
-    if (Error != 0)
+    return nullptr;
+}
+
+bool GitCodeSucceeded(GitCodes Code)
+{
+    switch (Code)
+    {
+    case GitCodes::FAST_FORWARD_SUCCESS:
+    case GitCodes::MERGE_SUCCESS:
+    case GitCodes::CHECKOUT_SUCCESS:
+    case GitCodes::ADD_SUCCESS:
+    case GitCodes::COMMIT_SUCCESS:
+    case GitCodes::PUSH_SUCCESS:
+    case GitCodes::UP_TO_DATE:
+    case GitCodes::NOTHING_TO_ADD:
+    case GitCodes::NOTHING_TO_COMMIT:
+    case GitCodes::NOTHING_TO_PUSH:
+    case GitCodes::CLONE_SUCCESS:
+    case GitCodes::DESCRIBE_SUCCESS:
+    case GitCodes::REMOTE_UP_TO_DATE:
+    case GitCodes::REMOTE_CHANGED:
+    case GitCodes::FETCH_SUCCESS:
+    case GitCodes::PREPARE_SUCCESS:
+    case GitCodes::ROLLBACK_SUCCESS:
+    case GitCodes::COPY_MEASURED:
+    case GitCodes::CONFIG_SUCCESS:
+    case GitCodes::PRUNE_SUCCESS:
+        return true;
+    default:
+        return false;
+    }
+}
+
+GitRepository::GitRepository(const std::string &Path, const std::string &Token, GitOperation *Operation)
+    : Repository(nullptr), Path(Path), Token(Token), Operation(Operation), Cached(true)
+{
+    Repository = Git::Cache::Acquire(Path);
+
+    if (Repository || !Git::Core::IsMainThread())
+        return;
+
+    // A worker holds the cached handle, so the main thread opens a short-lived one instead of waiting.
+    Cached = false;
+
+    if (git_repository_open(&Repository, Path.c_str()) != 0)
     {
         git_repository_free(Repository);
         Repository = nullptr;
         return;
     }
+
+    Git::Promisor::Attach(Repository);
 }
 
 GitRepository::~GitRepository()
 {
-    if (Repository)
+    if (Repository && Cached)
+        Git::Cache::Release(Path, Repository);
+    else if (Repository)
         git_repository_free(Repository);
 
     Repository = nullptr;
@@ -350,12 +514,25 @@ std::string GitRepository::GetShortHash()
     return std::string(ShortHash, 7);
 }
 
+std::string GitRepository::GetHash()
+{
+    if (!Repository)
+        return std::string();
+
+    git_oid Oid;
+
+    if (git_reference_name_to_id(&Oid, Repository, "HEAD") != 0)
+        return std::string();
+
+    return std::string(git_oid_tostr_s(&Oid));
+}
+
 std::string GitRepository::GetToken()
 {
     return Token;
 }
 
-GitCodes GitRepository::Pull()
+GitCodes GitRepository::Pull(const GitPullOptions &Options)
 {
     if (!Repository)
         return GitCodes::HEAD_LOOKUP_FAILED;
@@ -363,15 +540,11 @@ GitCodes GitRepository::Pull()
     git_fetch_options FetchOptions = GIT_FETCH_OPTIONS_INIT;
     git_merge_options MergeOptions = GIT_MERGE_OPTIONS_INIT;
     git_checkout_options CheckoutOptions = GIT_CHECKOUT_OPTIONS_INIT;
+    GitOperation Fallback(Token, Git::Dispatcher::NO_CALLBACK);
+    GitOperation *Active = Operation ? Operation : &Fallback;
 
-    if (!Token.empty())
-    {
-        const char *TokenPtr = Token.c_str();
-        FetchOptions.callbacks.credentials = Git::Functions::CredentialToken;
-        FetchOptions.callbacks.payload = (void *)TokenPtr;
-    }
-
-    FetchOptions.callbacks.certificate_check = Git::Functions::CertificateCheck;
+    Git::Functions::SetupRemoteCallbacks(FetchOptions.callbacks, Active);
+    Git::Functions::SetupCheckoutCallbacks(CheckoutOptions, Active);
 
     GitHead LocalHead(Repository);
 
@@ -389,7 +562,24 @@ GitCodes GitRepository::Pull()
     if (!Remote.GetRemote())
         return GitCodes::ORIGIN_LOOKUP_FAILED;
 
-    if (git_remote_fetch(Remote.GetRemote(), nullptr, &FetchOptions, nullptr) != 0)
+    // No depth here: the shallow boundary stays where Clone or Deepen put it. A depth counted from the new tip cuts
+    // it off from HEAD, e.g. a depth 1 clone followed by two upstream commits would see unrelated histories.
+    std::string BranchRefSpec = "+" + LocalBranchRef + ":" + RemoteBranchRef;
+    const char *BranchRefSpecs[] = {BranchRefSpec.c_str()};
+    const git_strarray BranchOnly = {(char **)BranchRefSpecs, 1};
+
+    std::string Mirror = Git::Reference::Location(Repository);
+
+    // Borrowing repositories fetch into the shared mirror and only move their branches, a failure there falls back
+    // to fetching origin directly.
+    bool Borrowed = !Options.SkipFetch && !Mirror.empty() &&
+                    Git::Reference::Update(Mirror, git_remote_url(Remote.GetRemote()), FetchOptions,
+                                           Options.CurrentBranchOnly ? LocalBranchName : "") == 0 &&
+                    Git::Reference::Sync(Repository, Mirror) == 0;
+
+    if (!Options.SkipFetch && !Borrowed &&
+        git_remote_fetch(Remote.GetRemote(), Options.CurrentBranchOnly ? &BranchOnly : nullptr, &FetchOptions,
+                         nullptr) != 0)
         return GitCodes::REMOTE_FETCH_FAILED;
 
     GitAnnotatedCommit RemoteCommit(Repository, RemoteBranchRef.c_str());
@@ -407,67 +597,32 @@ GitCodes GitRepository::Pull()
     if (Analysis & GIT_MERGE_ANALYSIS_UP_TO_DATE)
         return GitCodes::UP_TO_DATE;
 
+    if (Options.FetchOnly)
+        return GitCodes::FETCH_SUCCESS;
+
+    if (Options.FastForwardOnly && !(Analysis & GIT_MERGE_ANALYSIS_FASTFORWARD))
+        return GitCodes::NOT_FAST_FORWARD;
+
     const git_oid *TargetOid = git_annotated_commit_id(RemoteCommit.GetAnnotatedCommit());
 
     if (Analysis & GIT_MERGE_ANALYSIS_FASTFORWARD)
     {
         Git::Functions::PrintGitDiffSummary(Repository, OldHeadOid, *TargetOid);
 
-        GitCommit TargetCommit(Repository, TargetOid);
-
-        if (!TargetCommit.GetCommit())
+        if (!WriteStaged(OldHeadOid, *TargetOid))
             return GitCodes::FAST_FORWARD_FAILED;
 
-        git_tree *RawTree = nullptr;
-
-        if (git_commit_tree(&RawTree, TargetCommit.GetCommit()) != 0)
-        {
-            git_tree_free(RawTree);
-            return GitCodes::FAST_FORWARD_FAILED;
-        }
-
-        GitTree TargetTree(Repository, git_object_id((git_object *)RawTree));
-        git_tree_free(RawTree);
-
-        GitIndex Index(Repository);
-
-        if (git_index_read_tree(Index.GetIndex(), TargetTree.GetTree()) != 0)
-            return GitCodes::FAST_FORWARD_FAILED;
-
-        if (git_index_write(Index.GetIndex()) != 0)
+        if (!MoveBranch(LocalBranchRef, TargetOid))
             return GitCodes::FAST_FORWARD_FAILED;
 
-        CheckoutOptions.checkout_strategy = GIT_CHECKOUT_SAFE;
-
-        if (git_checkout_index(Repository, Index.GetIndex(), &CheckoutOptions) != 0)
-            return GitCodes::FAST_FORWARD_FAILED;
-
-        git_reference *BranchReference = nullptr;
-
-        if (git_reference_lookup(&BranchReference, Repository, LocalBranchRef.c_str()) != 0)
-        {
-            if (git_reference_create(&BranchReference, Repository, LocalBranchRef.c_str(), TargetOid, 0, nullptr) != 0)
-            {
-                git_reference_free(BranchReference);
-                return GitCodes::FAST_FORWARD_FAILED;
-            }
-        }
-
-        git_reference *UpdatedReference = nullptr;
-
-        if (git_reference_set_target(&UpdatedReference, BranchReference, TargetOid, "fast-forward") != 0)
-        {
-            git_reference_free(BranchReference);
-            git_reference_free(UpdatedReference);
-            return GitCodes::FAST_FORWARD_FAILED;
-        }
-
-        git_reference_free(BranchReference);
-        git_reference_free(UpdatedReference);
-        git_repository_set_head(Repository, LocalBranchRef.c_str());
+        Git::History::Record(Repository, OldHeadOid);
         return GitCodes::FAST_FORWARD_SUCCESS;
     }
 
+    // A deployment has no index or worktree of its own to merge in.
+    if ((Analysis & GIT_MERGE_ANALYSIS_NORMAL) && IsDeployment())
+        return GitCodes::NOT_FAST_FORWARD;
+
     if (Analysis & GIT_MERGE_ANALYSIS_NORMAL)
     {
         CheckoutOptions.checkout_strategy = GIT_CHECKOUT_SAFE;
@@ -496,6 +651,7 @@ GitCodes GitRepository::Pull()
                                 nullptr, "Merge remote changes", Tree.GetTree(), 1, ParentCommit.GetCommit()) != 0)
             return GitCodes::MERGE_FAILED;
 
+        Git::History::Record(Repository, OldHeadOid);
         return GitCodes::MERGE_SUCCESS;
     }
 
@@ -524,17 +680,42 @@ GitCodes GitRepository::Checkout(const std::string &Head)
         return GitCodes::CHECKOUT_FAILED;
 
     GitTree CheckoutTree(Repository, git_object_id((git_object *)RawTree));
-    GitIndex Index(Repository);
     git_tree_free(RawTree);
 
-    if (git_index_read_tree(Index.GetIndex(), CheckoutTree.GetTree()) != 0)
-        return GitCodes::CHECKOUT_FAILED;
-
     git_checkout_options CheckoutOptions = GIT_CHECKOUT_OPTIONS_INIT;
+    GitOperation Fallback(Token, Git::Dispatcher::NO_CALLBACK);
+
+    Git::Functions::SetupCheckoutCallbacks(CheckoutOptions, Operation ? Operation : &Fallback);
     CheckoutOptions.checkout_strategy = GIT_CHECKOUT_SAFE;
 
-    if (git_checkout_index(Repository, Index.GetIndex(), &CheckoutOptions) != 0)
-        return GitCodes::CHECKOUT_FAILED;
+    git_oid HeadOid;
+    bool Born = git_reference_name_to_id(&HeadOid, Repository, "HEAD") == 0;
+
+    if (Born)
+    {
+        if (!WriteStaged(HeadOid, TreeOid))
+            return GitCodes::CHECKOUT_FAILED;
+    }
+    else if (IsDeployment())
+    {
+        if (WriteDeployment(CheckoutTree.GetTree(), CheckoutOptions) != 0)
+            return GitCodes::CHECKOUT_FAILED;
+    }
+    else
+    {
+        GitParsedTree HeadTree(Repository, "HEAD^{tree}");
+
+        if (Git::Promisor::Prefetch(Repository, CheckoutTree.GetTree(), (git_tree *)HeadTree.GetObject(), nullptr) != 0)
+            return GitCodes::CHECKOUT_FAILED;
+
+        GitIndex Index(Repository);
+
+        if (git_index_read_tree(Index.GetIndex(), CheckoutTree.GetTree()) != 0)
+            return GitCodes::CHECKOUT_FAILED;
+
+        if (git_checkout_index(Repository, Index.GetIndex(), &CheckoutOptions) != 0)
+            return GitCodes::CHECKOUT_FAILED;
+    }
 
     std::string BranchRef = std::string("refs/heads/") + Head;
     git_reference *Temp = nullptr;
@@ -547,6 +728,9 @@ GitCodes GitRepository::Checkout(const std::string &Head)
     if (Temp)
         git_reference_free(Temp);
 
+    if (Born && !git_oid_equal(&HeadOid, &TreeOid))
+        Git::History::Record(Repository, HeadOid);
+
     return GitCodes::CHECKOUT_SUCCESS;
 }
 
@@ -564,6 +748,12 @@ GitCodes GitRepository::Add(const std::string &File, const std::string &Path)
     if (git_repository_index(&Index, Repository) != 0)
         return GitCodes::REPOSITORY_INDEX_FAILED;
 
+    if (git_index_read(Index, 0) != 0)
+    {
+        git_index_free(Index);
+        return GitCodes::REPOSITORY_INDEX_FAILED;
+    }
+
     bool IsAll = (File == "." || File == "*");
 
     if (git_reference_name_to_id(&ParentOid, Repository, "HEAD") == 0 &&
@@ -646,6 +836,12 @@ GitCodes GitRepository::Commit(const std::string &Message, const std::string &Au
     if (git_repository_index(&Index, Repository) != 0)
         return GitCodes::REPOSITORY_INDEX_FAILED;
 
+    if (git_index_read(Index, 0) != 0)
+    {
+        git_index_free(Index);
+        return GitCodes::REPOSITORY_INDEX_FAILED;
+    }
+
     if (git_index_write_tree(&TreeOid, Index) != 0)
         goto CommitFail;
 
@@ -717,15 +913,9 @@ GitCodes GitRepository::Push()
     git_remote *Remote = nullptr;
     git_oid OldLocalOid, OldRemoteOid, NewLocalOid;
     git_push_options PushOptions = GIT_PUSH_OPTIONS_INIT;
+    GitOperation Fallback(Token, Git::Dispatcher::NO_CALLBACK);
 
-    if (!Token.empty())
-    {
-        const char *TokenPtr = Token.c_str();
-        PushOptions.callbacks.credentials = Git::Functions::CredentialToken;
-        PushOptions.callbacks.payload = (void *)TokenPtr;
-    }
-
-    PushOptions.callbacks.certificate_check = Git::Functions::CertificateCheck;
+    Git::Functions::SetupRemoteCallbacks(PushOptions.callbacks, Operation ? Operation : &Fallback);
 
     if (git_remote_lookup(&Remote, Repository, "origin") != 0)
         return GitCodes::ORIGIN_LOOKUP_FAILED;
@@ -778,3 +968,395 @@ GitCodes GitRepository::Push()
     git_remote_free(Remote);
     return GitCodes::PUSH_SUCCESS;
 }
+
+GitCodes GitRepository::CheckRemote(std::string &RemoteHash)
+{
+    if (!Repository)
+        return GitCodes::HEAD_LOOKUP_FAILED;
+
+    git_remote_callbacks Callbacks = GIT_REMOTE_CALLBACKS_INIT;
+    GitOperation Fallback(Token, Git::Dispatcher::NO_CALLBACK);
+
+    Git::Functions::SetupRemoteCallbacks(Callbacks, Operation ? Operation : &Fallback);
+
+    GitHead LocalHead(Repository);
+
+    if (!LocalHead.GetHead() || !git_reference_is_branch(LocalHead.GetHead()))
+        return GitCodes::HEAD_LOOKUP_FAILED;
+
+    const git_oid *LocalOid = git_reference_target(LocalHead.GetHead());
+    std::string BranchRef = git_reference_name(LocalHead.GetHead());
+    std::string RemoteName = "origin";
+    git_reference *Upstream = nullptr;
+
+    // A branch tracking a differently named branch, or another remote, is compared against what it tracks. Without
+    // an upstream the branch of the same name on origin is used.
+    if (git_branch_upstream(&Upstream, LocalHead.GetHead()) == 0)
+    {
+        git_buf Merge = GIT_BUF_INIT, Name = GIT_BUF_INIT;
+
+        if (git_branch_upstream_merge(&Merge, Repository, BranchRef.c_str()) == 0 &&
+            git_branch_upstream_remote(&Name, Repository, BranchRef.c_str()) == 0 && strcmp(Name.ptr, ".") != 0)
+        {
+            BranchRef = Merge.ptr;
+            RemoteName = Name.ptr;
+        }
+
+        git_buf_dispose(&Merge);
+        git_buf_dispose(&Name);
+        git_reference_free(Upstream);
+    }
+
+    GitRemote Remote(Repository, RemoteName.c_str());
+
+    if (!Remote.GetRemote())
+        return GitCodes::ORIGIN_LOOKUP_FAILED;
+
+    // Only the ref advertisement is read, no negotiation or pack transfer takes place.
+    if (git_remote_connect(Remote.GetRemote(), GIT_DIRECTION_FETCH, &Callbacks, nullptr, nullptr) != 0)
+        return GitCodes::REMOTE_CONNECT_FAILED;
+
+    const git_remote_head **Heads = nullptr;
+    size_t Count = 0;
+    const git_oid *RemoteOid = nullptr;
+    git_oid Advertised;
+
+    if (git_remote_ls(&Heads, &Count, Remote.GetRemote()) == 0)
+    {
+        for (size_t Index = 0; Index < Count; ++Index)
+        {
+            if (BranchRef != Heads[Index]->name)
+                continue;
+
+            git_oid_cpy(&Advertised, &Heads[Index]->oid);
+            RemoteOid = &Advertised;
+            break;
+        }
+    }
+
+    git_remote_disconnect(Remote.GetRemote());
+
+    if (!RemoteOid)
+        return GitCodes::REMOTE_BRANCH_NOT_FOUND;
+
+    RemoteHash = git_oid_tostr_s(RemoteOid);
+
+    if (LocalOid && git_oid_equal(LocalOid, RemoteOid))
+        return GitCodes::REMOTE_UP_TO_DATE;
+
+    // A remote commit we already have and that HEAD builds on means we are ahead, not behind.
+    if (LocalOid && git_graph_descendant_of(Repository, LocalOid, RemoteOid) == 1)
+        return GitCodes::REMOTE_UP_TO_DATE;
+
+    return GitCodes::REMOTE_CHANGED;
+}
+
+GitCodes GitRepository::Deepen(int Depth)
+{
+    if (!Repository)
+        return GitCodes::HEAD_LOOKUP_FAILED;
+
+    git_fetch_options FetchOptions = GIT_FETCH_OPTIONS_INIT;
+    GitOperation Fallback(Token, Git::Dispatcher::NO_CALLBACK);
+
+    Git::Functions::SetupRemoteCallbacks(FetchOptions.callbacks, Operation ? Operation : &Fallback);
+
+    // The depth counts from the remote tips, so this can also make a repository shallower on the next fetch.
+    FetchOptions.depth = Depth > 0 ? Depth : GIT_FETCH_DEPTH_UNSHALLOW;
+
+    GitRemote Remote(Repository, "origin");
+
+    if (!Remote.GetRemote())
+        return GitCodes::ORIGIN_LOOKUP_FAILED;
+
+    GitHead LocalHead(Repository);
+    std::string BranchRefSpec;
+
+    if (LocalHead.GetHead() && git_reference_is_branch(LocalHead.GetHead()))
+        BranchRefSpec = std::string("+") + git_reference_name(LocalHead.GetHead()) + ":refs/remotes/origin/" +
+                        git_reference_shorthand(LocalHead.GetHead());
+
+    const char *BranchRefSpecs[] = {BranchRefSpec.c_str()};
+    const git_strarray BranchOnly = {(char **)BranchRefSpecs, 1};
+
+    if (git_remote_fetch(Remote.GetRemote(), BranchRefSpec.empty() ? nullptr : &BranchOnly, &FetchOptions, nullptr) !=
+        0)
+        return GitCodes::REMOTE_FETCH_FAILED;
+
+    return GitCodes::FETCH_SUCCESS;
+}
+
+bool GitRepository::IsDeployment()
+{
+    GitSparseOptions Sparse;
+
+    return Repository && Git::Sparse::Load(Repository, Sparse);
+}
+
+GitCodes GitRepository::SetSparse(const std::vector<std::string> &Patterns)
+{
+    GitSparseOptions Previous;
+
+    if (!Repository || !Git::Sparse::Load(Repository, Previous))
+        return GitCodes::NOT_A_DEPLOYMENT;
+
+    if (Previous.Patterns == Patterns)
+        return GitCodes::CHECKOUT_SUCCESS;
+
+    GitSparseOptions Current = Previous;
+    Current.Patterns = Patterns;
+
+    git_oid HeadOid;
+
+    if (git_reference_name_to_id(&HeadOid, Repository, "HEAD") != 0)
+        return GitCodes::HEAD_LOOKUP_FAILED;
+
+    GitCommit HeadCommit(Repository, &HeadOid);
+    git_tree *HeadTree = nullptr;
+
+    if (!HeadCommit.GetCommit() || git_commit_tree(&HeadTree, HeadCommit.GetCommit()) != 0)
+        return GitCodes::TREE_LOOKUP_FAILED;
+
+    Git::Sparse::Save(Repository, Current);
+    Git::Sparse::Prune(Repository, Path, Previous, Current, HeadTree);
+
+    git_checkout_options CheckoutOptions = GIT_CHECKOUT_OPTIONS_INIT;
+    GitOperation Fallback(Token, Git::Dispatcher::NO_CALLBACK);
+
+    Git::Functions::SetupCheckoutCallbacks(CheckoutOptions, Operation ? Operation : &Fallback);
+    CheckoutOptions.checkout_strategy = GIT_CHECKOUT_SAFE;
+
+    // Same tree on both sides, so only the paths the new patterns pulled in are missing and get written.
+    int Error = Git::Sparse::Write(Repository, Path, Current, HeadTree, HeadTree, CheckoutOptions);
+    git_tree_free(HeadTree);
+
+    return Error == 0 ? GitCodes::CHECKOUT_SUCCESS : GitCodes::CHECKOUT_FAILED;
+}
+
+int GitRepository::WriteDeployment(git_tree *Target, git_checkout_options &CheckoutOptions)
+{
+    GitSparseOptions Sparse;
+    git_oid HeadOid;
+    git_commit *HeadCommit = nullptr;
+    git_tree *HeadTree = nullptr;
+
+    Git::Sparse::Load(Repository, Sparse);
+
+    // HEAD still points at what is on disk, the caller moves it once the files are written.
+    if (git_reference_name_to_id(&HeadOid, Repository, "HEAD") == 0 &&
+        git_commit_lookup(&HeadCommit, Repository, &HeadOid) == 0)
+        git_commit_tree(&HeadTree, HeadCommit);
+
+    int Error = Git::Sparse::Write(Repository, Path, Sparse, Target, HeadTree, CheckoutOptions);
+
+    git_tree_free(HeadTree);
+    git_commit_free(HeadCommit);
+
+    return Error;
+}
+
+GitCodes GitRepository::Prepare(bool SkipFetch)
+{
+    if (!Repository)
+        return GitCodes::HEAD_LOOKUP_FAILED;
+
+    GitPullOptions Options;
+    Options.FetchOnly = true;
+    Options.SkipFetch = SkipFetch;
+
+    GitCodes Code = Pull(Options);
+
+    if (Code == GitCodes::UP_TO_DATE)
+        Git::Stage::Discard(Path);
+
+    if (Code != GitCodes::FETCH_SUCCESS)
+        return Code;
+
+    GitHead LocalHead(Repository);
+
+    if (!LocalHead.GetHead() || !git_reference_target(LocalHead.GetHead()))
+        return GitCodes::HEAD_LOOKUP_FAILED;
+
+    const char *LocalBranchName = git_reference_shorthand(LocalHead.GetHead());
+    std::string RemoteBranchRef = std::string("refs/remotes/origin/").append(LocalBranchName);
+    git_oid OldOid = *git_reference_target(LocalHead.GetHead());
+    git_oid TargetOid;
+
+    if (git_reference_name_to_id(&TargetOid, Repository, RemoteBranchRef.c_str()) != 0)
+        return GitCodes::HEAD_READ_FAILED;
+
+    if (git_graph_descendant_of(Repository, &TargetOid, &OldOid) != 1)
+        return GitCodes::NOT_FAST_FORWARD;
+
+    GitOperation Fallback(Token, Git::Dispatcher::NO_CALLBACK);
+
+    Git::Functions::PrintGitDiffSummary(Repository, OldOid, TargetOid);
+
+    return Git::Stage::Prepare(Repository, Path, OldOid, TargetOid, git_reference_name(LocalHead.GetHead()),
+                               IsAtomic(), Operation ? *Operation : Fallback);
+}
+
+GitCodes GitRepository::Apply()
+{
+    if (!Repository)
+        return GitCodes::HEAD_LOOKUP_FAILED;
+
+    git_oid PreviousOid, TargetOid;
+    std::string BranchRef;
+    bool Born = git_reference_name_to_id(&PreviousOid, Repository, "HEAD") == 0;
+    GitCodes Code = Git::Stage::Apply(Repository, Path, TargetOid, BranchRef);
+
+    if (Code != GitCodes::FAST_FORWARD_SUCCESS)
+        return Code;
+
+    if (!MoveBranch(BranchRef, &TargetOid))
+        return GitCodes::FAST_FORWARD_FAILED;
+
+    if (Born)
+        Git::History::Record(Repository, PreviousOid);
+
+    return Code;
+}
+
+bool GitRepository::IsAtomic()
+{
+    git_config *Config = nullptr;
+    int Atomic = 0;
+
+    if (Repository && git_repository_config_snapshot(&Config, Repository) == 0)
+        git_config_get_bool(&Atomic, Config, GIT_ATOMIC_CONFIG);
+
+    git_config_free(Config);
+
+    return Atomic != 0;
+}
+
+bool GitRepository::SetAtomic(bool Atomic)
+{
+    git_config *Config = nullptr;
+
+    if (!Repository || git_repository_config(&Config, Repository) != 0)
+        return false;
+
+    int Error = Atomic ? git_config_set_bool(Config, GIT_ATOMIC_CONFIG, true)
+                       : git_config_delete_entry(Config, GIT_ATOMIC_CONFIG);
+
+    git_config_free(Config);
+
+    return Error == 0 || (!Atomic && Error == GIT_ENOTFOUND);
+}
+
+// Writes only the paths that differ between Old and Target, in place or by swapping the tree for atomic
+// repositories. The caller moves HEAD.
+bool GitRepository::WriteStaged(const git_oid &Old, const git_oid &Target)
+{
+    GitOperation Fallback(Token, Git::Dispatcher::NO_CALLBACK);
+    git_oid Applied;
+    std::string BranchRef;
+
+    GitOperation &Active = Operation ? *Operation : Fallback;
+
+    if (Git::Stage::Prepare(Repository, Path, Old, Target, std::string(), IsAtomic(), Active) !=
+        GitCodes::PREPARE_SUCCESS)
+        return false;
+
+    return Git::Stage::Apply(Repository, Path, Applied, BranchRef) == GitCodes::FAST_FORWARD_SUCCESS;
+}
+
+bool GitRepository::MoveBranch(const std::string &BranchRef, const git_oid *Target)
+{
+    git_reference *BranchReference = nullptr;
+
+    if (git_reference_lookup(&BranchReference, Repository, BranchRef.c_str()) != 0)
+    {
+        if (git_reference_create(&BranchReference, Repository, BranchRef.c_str(), Target, 0, nullptr) != 0)
+        {
+            git_reference_free(BranchReference);
+            return false;
+        }
+    }
+
+    git_reference *UpdatedReference = nullptr;
+
+    if (git_reference_set_target(&UpdatedReference, BranchReference, Target, "fast-forward") != 0)
+    {
+        git_reference_free(BranchReference);
+        git_reference_free(UpdatedReference);
+        return false;
+    }
+
+    git_reference_free(BranchReference);
+    git_reference_free(UpdatedReference);
+    git_repository_set_head(Repository, BranchRef.c_str());
+
+    return true;
+}
+
+GitCodes GitRepository::Rollback(int Steps, std::vector<std::string> &Files)
+{
+    if (!Repository)
+        return GitCodes::HEAD_LOOKUP_FAILED;
+
+    GitHead LocalHead(Repository);
+
+    if (!LocalHead.GetHead() || !git_reference_target(LocalHead.GetHead()))
+        return GitCodes::HEAD_LOOKUP_FAILED;
+
+    git_oid CurrentOid = *git_reference_target(LocalHead.GetHead());
+    std::vector<std::string> Hashes = Git::History::Load(Repository);
+
+    if (Steps < 1 || (size_t)Steps > Hashes.size())
+    {
+        git_error_set_str(GIT_ERROR_INVALID,
+                          ("Only " + std::to_string(Hashes.size()) + " earlier revisions are kept").c_str());
+        return GitCodes::ROLLBACK_UNAVAILABLE;
+    }
+
+    std::string Hash = Hashes[Hashes.size() - Steps];
+    git_oid TargetOid;
+
+    if (git_oid_fromstr(&TargetOid, Hash.c_str()) != 0)
+        return GitCodes::TARGET_LOOKUP_FAILED;
+
+    bool Detached = git_repository_head_detached(Repository) == 1;
+    std::string BranchRef = Detached ? std::string() : git_reference_name(LocalHead.GetHead());
+    bool Atomic = IsAtomic();
+    GitOperation Fallback(Token, Git::Dispatcher::NO_CALLBACK);
+
+    git_oid AppliedOid;
+    std::string AppliedRef;
+
+    // One step back only moves the files the last update replaced back into place. Older revisions, or files that
+    // changed since, are staged from the trees like any other update.
+    GitCodes Code = Steps == 1 ? Git::Stage::PrepareRollback(Repository, Path, CurrentOid, TargetOid, BranchRef, Atomic)
+                               : GitCodes::NOTHING_PREPARED;
+
+    if (Code == GitCodes::PREPARE_SUCCESS)
+    {
+        Files = Git::Stage::Changes(Path);
+        Code = Git::Stage::Apply(Repository, Path, AppliedOid, AppliedRef);
+    }
+
+    if (Code == GitCodes::NOTHING_PREPARED || Code == GitCodes::PREPARED_STATE_CHANGED)
+    {
+        Code = Git::Stage::Prepare(Repository, Path, CurrentOid, TargetOid, BranchRef, Atomic,
+                                   Operation ? *Operation : Fallback);
+
+        if (Code != GitCodes::PREPARE_SUCCESS)
+            return Code;
+
+        Files = Git::Stage::Changes(Path);
+        Code = Git::Stage::Apply(Repository, Path, AppliedOid, AppliedRef);
+    }
+
+    if (Code != GitCodes::FAST_FORWARD_SUCCESS)
+        return Code;
+
+    if (Detached ? git_repository_set_head_detached(Repository, &TargetOid) != 0 : !MoveBranch(BranchRef, &TargetOid))
+        return GitCodes::CHECKOUT_FAILED;
+
+    // The revision we went back to is current again, it and everything newer leave the history.
+    Git::History::Truncate(Repository, (size_t)Steps);
+
+    return GitCodes::ROLLBACK_SUCCESS;
+}
@@ -1,6 +1,8 @@
 #pragma once
 #include "../includes.h"
 
+class GitOperation;
+
 enum GitCodes
 {
     FAST_FORWARD_SUCCESS = 0,
@@ -29,26 +31,124 @@ enum GitCodes
     FILE_NOT_FOUND,
     ADD_FAILED,
     COMMIT_FAILED,
-    PUSH_FAILED
+    PUSH_FAILED,
+    CLONE_SUCCESS,
+    CLONE_FAILED,
+    REPOSITORY_OPEN_FAILED,
+    OPERATION_CANCELLED,
+    OPERATION_TIMED_OUT,
+    DESCRIBE_SUCCESS,
+    REMOTE_UP_TO_DATE,
+    REMOTE_CHANGED,
+    REMOTE_CONNECT_FAILED,
+    REMOTE_BRANCH_NOT_FOUND,
+    FETCH_SUCCESS,
+    NOT_FAST_FORWARD,
+    BRANCH_MISMATCH,
+    NOT_A_DEPLOYMENT,
+    PREPARE_SUCCESS,
+    NOTHING_PREPARED,
+    PREPARED_STATE_CHANGED,
+    ROLLBACK_SUCCESS,
+    ROLLBACK_UNAVAILABLE,
+    COPY_MEASURED,
+    COPY_FAILED,
+    CONFIG_SUCCESS,
+    CONFIG_FAILED,
+    PRUNE_SUCCESS
+};
+
+const char *GitCodeName(GitCodes Code);
+bool GitCodeSucceeded(GitCodes Code);
+
+// Repository config entries of a sparse deployment, the root entry is written even when it is empty.
+constexpr const char *GIT_SPARSE_CONFIG = "gmsvgit.sparse";
+constexpr const char *GIT_ROOT_CONFIG = "gmsvgit.root";
+// Repository config entry that makes Pull, Checkout and Apply swap in a whole new working tree.
+constexpr const char *GIT_ATOMIC_CONFIG = "gmsvgit.atomic";
+// Repository config entry holding how many earlier revisions are kept for Rollback.
+constexpr const char *GIT_KEEP_CONFIG = "gmsvgit.keep";
+// Repository config entry holding the blob store checkouts hard link their files from.
+constexpr const char *GIT_STORE_CONFIG = "gmsvgit.store";
+// Repository config entry holding the host-wide mirror the repository borrows its objects from.
+constexpr const char *GIT_REFERENCE_CONFIG = "gmsvgit.reference";
+
+struct GitSparseOptions
+{
+    // Pathspecs of the files written to the destination, relative to Root. Empty writes every file.
+    std::vector<std::string> Patterns;
+    // Repository directory that becomes the destination, e.g. "addon" writes addon/lua to <destination>/lua.
+    std::string Root;
+};
+
+struct GitCloneOptions
+{
+    // Number of commits to fetch per branch, 0 fetches the whole history.
+    int Depth = 0;
+    // Branch to check out, the remote's default branch when empty.
+    std::string Branch;
+    // Only fetch Branch, now and on every later fetch.
+    bool SingleBranch = false;
+    // Clones a deployment that only writes these paths, see GitSparseOptions.
+    GitSparseOptions Sparse;
+    // Only fetch commits and trees, blobs are fetched from origin when a checkout needs them.
+    bool Blobless = false;
+    // Update by swapping directories, see GIT_ATOMIC_CONFIG.
+    bool Atomic = false;
+    // Hard link the files from this blob store, see GIT_STORE_CONFIG.
+    std::string Store;
+    // Directory of host-wide mirrors to borrow objects from, see GIT_REFERENCE_CONFIG.
+    std::string Reference;
+};
+
+struct GitPullOptions
+{
+    // Stop after updating the remote-tracking branch.
+    bool FetchOnly = false;
+    // Refuse to merge when the branches have diverged.
+    bool FastForwardOnly = false;
+    // Use the remote-tracking branch as it is, e.g. to apply an earlier fetch.
+    bool SkipFetch = false;
+    // Fetch only the checked out branch instead of every configured refspec.
+    bool CurrentBranchOnly = true;
 };
 
 class GitRepository
 {
   public:
-    GitRepository(const std::string &Path, const std::string &Token);
+    GitRepository(const std::string &Path, const std::string &Token, GitOperation *Operation = nullptr);
     ~GitRepository();
     git_repository *GetRepository();
     bool Valid();
     std::string GetBranch();
     std::string GetShortHash();
+    std::string GetHash();
     std::string GetToken();
-    GitCodes Pull();
+    GitCodes Pull(const GitPullOptions &Options = GitPullOptions());
     GitCodes Checkout(const std::string &Head);
     GitCodes Add(const std::string &File, const std::string &Path);
     GitCodes Commit(const std::string &Message, const std::string &AuthorName, const std::string &AuthorEmail);
     GitCodes Push();
+    GitCodes CheckRemote(std::string &RemoteHash);
+    GitCodes Deepen(int Depth);
+    bool IsDeployment();
+    GitCodes SetSparse(const std::vector<std::string> &Patterns);
+    // Fetches and stages a fast-forward without touching the working tree, Apply then only moves files into place.
+    GitCodes Prepare(bool SkipFetch = false);
+    GitCodes Apply();
+    bool IsAtomic();
+    bool SetAtomic(bool Atomic);
+    // Goes back Steps updates, Files receives every path that was written or removed.
+    GitCodes Rollback(int Steps, std::vector<std::string> &Files);
 
   private:
+    int WriteDeployment(git_tree *Target, git_checkout_options &CheckoutOptions);
+    bool WriteStaged(const git_oid &Old, const git_oid &Target);
+    bool MoveBranch(const std::string &BranchRef, const git_oid *Target);
+
     git_repository *Repository;
+    std::string Path;
     std::string Token;
+    GitOperation *Operation;
+    bool Cached;
 };
\ No newline at end of file
@@ -0,0 +1,103 @@
+#include "history.h"
+#include "../git/git.h"
+
+namespace Git::History
+{
+constexpr int DEFAULT_KEEP = 5;
+
+static std::filesystem::path File(git_repository *Repository)
+{
+    return std::filesystem::path(git_repository_path(Repository)) / "gmsvgit-history";
+}
+
+static size_t Keep(git_repository *Repository)
+{
+    git_config *Config = nullptr;
+    int32_t Keep = DEFAULT_KEEP;
+
+    if (git_repository_config_snapshot(&Config, Repository) == 0)
+        git_config_get_int32(&Keep, Config, GIT_KEEP_CONFIG);
+
+    git_config_free(Config);
+
+    return (size_t)std::max(Keep, 0);
+}
+
+static void Save(git_repository *Repository, const std::vector<std::string> &Hashes)
+{
+    std::error_code ErrorCode;
+    std::filesystem::path Temporary = File(Repository);
+    Temporary += ".tmp";
+
+    {
+        std::ofstream Stream(Temporary, std::ios::trunc);
+
+        for (const std::string &Hash : Hashes)
+            Stream << Hash << '\n';
+    }
+
+    std::filesystem::rename(Temporary, File(Repository), ErrorCode);
+}
+
+static std::vector<std::string> Read(const std::filesystem::path &History)
+{
+    std::vector<std::string> Hashes;
+    std::ifstream Stream(History);
+    std::string Line;
+
+    while (std::getline(Stream, Line))
+        if (Line.size() == GIT_OID_SHA1_HEXSIZE)
+            Hashes.push_back(Line);
+
+    return Hashes;
+}
+
+std::vector<std::string> Load(git_repository *Repository)
+{
+    return Read(File(Repository));
+}
+
+std::vector<std::string> Load(const std::string &Path)
+{
+    std::filesystem::path GitDirectory = std::filesystem::path(Path) / ".git";
+    std::error_code ErrorCode;
+
+    // A .git file points at the real git dir, e.g. "gitdir: ../x.git".
+    if (std::filesystem::is_regular_file(GitDirectory, ErrorCode))
+    {
+        std::ifstream Stream(GitDirectory);
+        std::string Line;
+
+        if (!std::getline(Stream, Line) || Line.compare(0, 8, "gitdir: ") != 0)
+            return {};
+
+        while (!Line.empty() && (Line.back() == '\r' || Line.back() == ' '))
+            Line.pop_back();
+
+        GitDirectory = std::filesystem::path(Path) / Line.substr(8);
+    }
+
+    return Read(GitDirectory / "gmsvgit-history");
+}
+
+void Record(git_repository *Repository, const git_oid &Previous)
+{
+    std::vector<std::string> Hashes = Load(Repository);
+    size_t Limit = Keep(Repository);
+
+    Hashes.push_back(git_oid_tostr_s(&Previous));
+
+    if (Hashes.size() > Limit)
+        Hashes.erase(Hashes.begin(), Hashes.end() - Limit);
+
+    Save(Repository, Hashes);
+}
+
+void Truncate(git_repository *Repository, size_t Count)
+{
+    std::vector<std::string> Hashes = Load(Repository);
+
+    Hashes.resize(Hashes.size() - std::min(Count, Hashes.size()));
+    Save(Repository, Hashes);
+}
+} // namespace Git::History
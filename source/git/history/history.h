@@ -0,0 +1,14 @@
+#pragma once
+#include "../includes.h"
+
+// Revisions a repository was on before each update, oldest first, in <git dir>/gmsvgit-history.
+namespace Git::History
+{
+std::vector<std::string> Load(git_repository *Repository);
+// Reads the history of the repository in the working directory Path without opening it.
+std::vector<std::string> Load(const std::string &Path);
+// Appends Previous and drops entries beyond the gmsvgit.keep limit.
+void Record(git_repository *Repository, const git_oid &Previous);
+// Drops the newest Count entries, e.g. the revision a rollback went back to and everything after it.
+void Truncate(git_repository *Repository, size_t Count);
+} // namespace Git::History
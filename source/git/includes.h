@@ -8,11 +8,27 @@
 #include <functional>
 #include <filesystem>
 #include <fstream>
+#include <sstream>
 #include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <set>
+#include <list>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <algorithm>
 #include <map>
+#include <random>
+#include <optional>
 #include <git2.h>
 
 #ifdef _WIN32
+// Must come before Windows.h, which otherwise pulls in the incompatible winsock.h.
+#include <winsock2.h>
+#include <ws2tcpip.h>
 #include <Windows.h>
 #endif
 
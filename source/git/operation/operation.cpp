@@ -0,0 +1,295 @@
+#include "operation.h"
+#include "../dispatcher/dispatcher.h"
+
+GitOperation::GitOperation(const std::string &Token, int Callback) : Token(Token), Callback(Callback)
+{
+}
+
+static int64_t Now()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void GitOperation::Start()
+{
+    Touch();
+    Status.store(GitOperationStatus::RUNNING);
+}
+
+void GitOperation::Finish()
+{
+    GitOperationStatus Final = GitOperationStatus::COMPLETED;
+
+    if (TimeoutReached.load() && !GitCodeSucceeded(Result.Code))
+    {
+        Result.Code = GitCodes::OPERATION_TIMED_OUT;
+        Final = GitOperationStatus::FAILED;
+    }
+    else if (CancelRequested.load() && !GitCodeSucceeded(Result.Code))
+    {
+        Result.Code = GitCodes::OPERATION_CANCELLED;
+        Final = GitOperationStatus::CANCELLED;
+    }
+    else if (!GitCodeSucceeded(Result.Code))
+        Final = GitOperationStatus::FAILED;
+
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        Status.store(Final);
+    }
+
+    Condition.notify_all();
+}
+
+void GitOperation::Cancel()
+{
+    CancelRequested.store(true);
+}
+
+bool GitOperation::Cancelled() const
+{
+    return CancelRequested.load();
+}
+
+bool GitOperation::Wait(double Seconds)
+{
+    std::unique_lock<std::mutex> Lock(Mutex);
+    auto Done = [this] {
+        GitOperationStatus Current = Status.load();
+        return Current != GitOperationStatus::QUEUED && Current != GitOperationStatus::RUNNING;
+    };
+
+    if (Seconds < 0)
+    {
+        Condition.wait(Lock, Done);
+        return true;
+    }
+
+    return Condition.wait_for(Lock, std::chrono::duration<double>(Seconds), Done);
+}
+
+GitOperationStatus GitOperation::GetStatus() const
+{
+    return Status.load();
+}
+
+void GitOperation::EnterPhase(GitOperationPhase Next)
+{
+    Phase.store(Next);
+    Touch();
+}
+
+void GitOperation::Touch()
+{
+    LastActivity.store(Now());
+}
+
+void GitOperation::TimeOut()
+{
+    TimeoutReached.store(true);
+    CancelRequested.store(true);
+}
+
+bool GitOperation::TimedOut() const
+{
+    return TimeoutReached.load();
+}
+
+GitOperationPhase GitOperation::GetPhase() const
+{
+    return Phase.load();
+}
+
+double GitOperation::GetIdleSeconds() const
+{
+    return (double)(Now() - LastActivity.load()) / 1000.0;
+}
+
+namespace Git::Operation
+{
+static int MetaTableType = -1;
+
+static std::shared_ptr<GitOperation> Check(GarrysMod::Lua::ILuaBase *LUA)
+{
+    std::shared_ptr<GitOperation> Operation = Get(LUA, 1);
+
+    if (!Operation)
+        LUA->ArgError(1, "expected GitOperation");
+
+    return Operation;
+}
+
+LUA_FUNCTION_STATIC(StatusMethod)
+{
+    std::shared_ptr<GitOperation> Operation = Check(LUA);
+
+    LUA->PushString(StatusName(Operation->GetStatus()));
+
+    return 1;
+}
+
+LUA_FUNCTION_STATIC(ProgressMethod)
+{
+    std::shared_ptr<GitOperation> Operation = Check(LUA);
+
+    LUA->CreateTable();
+
+    LUA->PushNumber((double)Operation->ReceivedObjects.load());
+    LUA->SetField(-2, "ReceivedObjects");
+
+    LUA->PushNumber((double)Operation->IndexedObjects.load());
+    LUA->SetField(-2, "IndexedObjects");
+
+    LUA->PushNumber((double)Operation->TotalObjects.load());
+    LUA->SetField(-2, "TotalObjects");
+
+    LUA->PushNumber((double)Operation->ReceivedBytes.load());
+    LUA->SetField(-2, "ReceivedBytes");
+
+    LUA->PushNumber((double)Operation->CheckoutSteps.load());
+    LUA->SetField(-2, "CheckoutSteps");
+
+    LUA->PushNumber((double)Operation->TotalCheckoutSteps.load());
+    LUA->SetField(-2, "TotalCheckoutSteps");
+
+    LUA->PushString(PhaseName(Operation->GetPhase()));
+    LUA->SetField(-2, "Phase");
+
+    return 1;
+}
+
+LUA_FUNCTION_STATIC(WaitMethod)
+{
+    std::shared_ptr<GitOperation> Operation = Check(LUA);
+    double Seconds = LUA->IsType(2, GarrysMod::Lua::Type::Number) ? LUA->GetNumber(2) : -1;
+
+    LUA->PushBool(Operation->Wait(Seconds));
+
+    return 1;
+}
+
+LUA_FUNCTION_STATIC(CancelMethod)
+{
+    std::shared_ptr<GitOperation> Operation = Check(LUA);
+
+    Operation->Cancel();
+
+    return 0;
+}
+
+LUA_FUNCTION_STATIC(ResultMethod)
+{
+    std::shared_ptr<GitOperation> Operation = Check(LUA);
+    GitOperationStatus Status = Operation->GetStatus();
+
+    if (Status == GitOperationStatus::QUEUED || Status == GitOperationStatus::RUNNING)
+        return 0;
+
+    Dispatcher::PushResult(LUA, Operation->Result);
+
+    return 1;
+}
+
+LUA_FUNCTION_STATIC(ToStringMethod)
+{
+    std::shared_ptr<GitOperation> Operation = Check(LUA);
+    std::string Text = std::string("GitOperation [") + StatusName(Operation->GetStatus()) + "]";
+
+    LUA->PushString(Text.c_str());
+
+    return 1;
+}
+
+LUA_FUNCTION_STATIC(GarbageCollect)
+{
+    auto *Handle = LUA->GetUserType<std::shared_ptr<GitOperation>>(1, MetaTableType);
+
+    if (!Handle)
+        return 0;
+
+    delete Handle;
+    LUA->SetUserType(1, nullptr);
+
+    return 0;
+}
+
+void Initialize(GarrysMod::Lua::ILuaBase *LUA)
+{
+    MetaTableType = LUA->CreateMetaTable("GitOperation");
+    {
+        LUA->Push(-1);
+        LUA->SetField(-2, "__index");
+
+        LUA->PushCFunction(GarbageCollect);
+        LUA->SetField(-2, "__gc");
+
+        LUA->PushCFunction(ToStringMethod);
+        LUA->SetField(-2, "__tostring");
+
+        LUA->PushCFunction(StatusMethod);
+        LUA->SetField(-2, "Status");
+
+        LUA->PushCFunction(ProgressMethod);
+        LUA->SetField(-2, "Progress");
+
+        LUA->PushCFunction(WaitMethod);
+        LUA->SetField(-2, "Wait");
+
+        LUA->PushCFunction(CancelMethod);
+        LUA->SetField(-2, "Cancel");
+
+        LUA->PushCFunction(ResultMethod);
+        LUA->SetField(-2, "Result");
+    }
+    LUA->Pop();
+}
+
+void Push(GarrysMod::Lua::ILuaBase *LUA, const std::shared_ptr<GitOperation> &Operation)
+{
+    LUA->PushUserType(new std::shared_ptr<GitOperation>(Operation), MetaTableType);
+}
+
+std::shared_ptr<GitOperation> Get(GarrysMod::Lua::ILuaBase *LUA, int StackPos)
+{
+    auto *Handle = LUA->GetUserType<std::shared_ptr<GitOperation>>(StackPos, MetaTableType);
+
+    return Handle ? *Handle : nullptr;
+}
+
+const char *StatusName(GitOperationStatus Status)
+{
+    switch (Status)
+    {
+    case GitOperationStatus::QUEUED:
+        return "queued";
+    case GitOperationStatus::RUNNING:
+        return "running";
+    case GitOperationStatus::COMPLETED:
+        return "completed";
+    case GitOperationStatus::FAILED:
+        return "failed";
+    case GitOperationStatus::CANCELLED:
+        return "cancelled";
+    }
+
+    return "unknown";
+}
+
+const char *PhaseName(GitOperationPhase Phase)
+{
+    switch (Phase)
+    {
+    case GitOperationPhase::NONE:
+        return "none";
+    case GitOperationPhase::CONNECT:
+        return "connect";
+    case GitOperationPhase::TRANSFER:
+        return "transfer";
+    case GitOperationPhase::CHECKOUT:
+        return "checkout";
+    }
+
+    return "unknown";
+}
+} // namespace Git::Operation
@@ -0,0 +1,90 @@
+#pragma once
+#include "../includes.h"
+#include "../git/git.h"
+#include "../snapshot/snapshot.h"
+
+struct GitResult
+{
+    GitCodes Code = GitCodes::REPOSITORY_OPEN_FAILED;
+    std::string OldOid;
+    std::string NewOid;
+    std::string Error;
+    // Paths written or removed, only filled in by operations that report them.
+    std::vector<std::string> Files;
+    // Named numbers an operation reports besides the code, e.g. the timings of MeasureCopy.
+    std::map<std::string, double> Numbers;
+    std::shared_ptr<const GitSnapshot> Snapshot;
+};
+
+enum class GitOperationStatus
+{
+    QUEUED = 0,
+    RUNNING,
+    COMPLETED,
+    FAILED,
+    CANCELLED
+};
+
+enum class GitOperationPhase
+{
+    NONE = 0,
+    CONNECT,
+    TRANSFER,
+    CHECKOUT
+};
+
+class GitOperation
+{
+  public:
+    GitOperation(const std::string &Token, int Callback);
+
+    void Start();
+    void Finish();
+    void Cancel();
+    bool Cancelled() const;
+    bool Wait(double Seconds);
+    GitOperationStatus GetStatus() const;
+
+    void EnterPhase(GitOperationPhase Phase);
+    void Touch();
+    void TimeOut();
+    bool TimedOut() const;
+    GitOperationPhase GetPhase() const;
+    double GetIdleSeconds() const;
+
+    std::string Token;
+    int Callback;
+    GitResult Result;
+
+    std::atomic<size_t> ReceivedObjects{0};
+    std::atomic<size_t> IndexedObjects{0};
+    std::atomic<size_t> TotalObjects{0};
+    std::atomic<size_t> ReceivedBytes{0};
+    std::atomic<size_t> CheckoutSteps{0};
+    std::atomic<size_t> TotalCheckoutSteps{0};
+
+    // Only touched by the worker running the operation.
+    int TransferPercent = -1;
+    int CheckoutPercent = -1;
+    // Working tree paths the operation changed, unset when it cannot tell. The snapshot refresh after it only looks
+    // at these.
+    std::optional<std::vector<std::string>> Touched;
+
+  private:
+    std::atomic<GitOperationStatus> Status{GitOperationStatus::QUEUED};
+    std::atomic<bool> CancelRequested{false};
+    std::atomic<bool> TimeoutReached{false};
+    std::atomic<GitOperationPhase> Phase{GitOperationPhase::NONE};
+    std::atomic<int64_t> LastActivity{0};
+    std::mutex Mutex;
+    std::condition_variable Condition;
+};
+
+namespace Git::Operation
+{
+void Initialize(GarrysMod::Lua::ILuaBase *LUA);
+void Push(GarrysMod::Lua::ILuaBase *LUA, const std::shared_ptr<GitOperation> &Operation);
+std::shared_ptr<GitOperation> Get(GarrysMod::Lua::ILuaBase *LUA, int StackPos);
+const char *StatusName(GitOperationStatus Status);
+const char *PhaseName(GitOperationPhase Phase);
+} // namespace Git::Operation
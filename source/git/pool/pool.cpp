@@ -0,0 +1,216 @@
+#include "pool.h"
+#include "../core/core.h"
+#include "../logger/logger.h"
+
+namespace Git::Pool
+{
+struct Lane
+{
+    std::deque<std::function<void()>> Jobs;
+    bool Busy = false;
+};
+
+static std::mutex Mutex;
+static std::condition_variable Condition;
+static std::map<std::string, Lane> Lanes;
+static std::deque<std::string> Ready;
+static std::vector<std::thread> Workers;
+// Workers that left after a shrink, their threads still sit in Workers until joined.
+static std::vector<std::thread::id> Exited;
+static size_t TargetWorkers = 0;
+static size_t RunningWorkers = 0;
+static size_t Queued = 0;
+static size_t InFlight = 0;
+static bool Stopping = false;
+
+static void WorkerLoop()
+{
+    std::unique_lock<std::mutex> Lock(Mutex);
+
+    while (true)
+    {
+        Condition.wait(Lock, [] { return Stopping || !Ready.empty() || RunningWorkers > TargetWorkers; });
+
+        if (RunningWorkers > TargetWorkers || Ready.empty())
+            break;
+
+        std::string Key = std::move(Ready.front());
+        Ready.pop_front();
+
+        Lane &RepositoryLane = Lanes[Key];
+        std::function<void()> Job = std::move(RepositoryLane.Jobs.front());
+        RepositoryLane.Jobs.pop_front();
+        RepositoryLane.Busy = true;
+        Queued--;
+        InFlight++;
+
+        Lock.unlock();
+
+        try
+        {
+            Job();
+        }
+        catch (const std::exception &Exception)
+        {
+            Logger::Log(Logger::Error("Unhandled exception in worker: {red}%s"), Exception.what());
+        }
+
+        Lock.lock();
+        InFlight--;
+
+        // Lanes is a std::map, so the reference survives insertions made while the job ran.
+        RepositoryLane.Busy = false;
+
+        if (RepositoryLane.Jobs.empty())
+            Lanes.erase(Key);
+        else
+        {
+            Ready.push_back(Key);
+            Condition.notify_one();
+        }
+    }
+
+    RunningWorkers--;
+    Exited.push_back(std::this_thread::get_id());
+}
+
+// Moves the threads of exited workers out of Workers, the caller joins them once the lock is released.
+static std::vector<std::thread> TakeExited()
+{
+    std::vector<std::thread> Joining;
+
+    for (std::thread::id Id : Exited)
+    {
+        auto Iterator = std::find_if(Workers.begin(), Workers.end(),
+                                     [&](const std::thread &Worker) { return Worker.get_id() == Id; });
+
+        if (Iterator == Workers.end())
+            continue;
+
+        Joining.push_back(std::move(*Iterator));
+        Workers.erase(Iterator);
+    }
+
+    Exited.clear();
+
+    return Joining;
+}
+
+static void SpawnWorkers()
+{
+    while (RunningWorkers < TargetWorkers)
+    {
+        RunningWorkers++;
+        Workers.emplace_back(WorkerLoop);
+    }
+}
+
+void Initialize(size_t Count)
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+
+    Stopping = false;
+    TargetWorkers = std::max<size_t>(Count, 1);
+    SpawnWorkers();
+}
+
+void Shutdown()
+{
+    std::vector<std::thread> Joining;
+
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+
+        if (Queued > 0 || InFlight > 0)
+            Logger::Log(Logger::Info("Waiting for {yellow}%zu{white} queued and {yellow}%zu{white} running jobs..."),
+                        Queued, InFlight);
+
+        Stopping = true;
+        Joining.swap(Workers);
+        Exited.clear();
+    }
+
+    Condition.notify_all();
+
+    for (std::thread &Worker : Joining)
+        if (Worker.joinable())
+            Worker.join();
+
+    std::lock_guard<std::mutex> Lock(Mutex);
+    TargetWorkers = 0;
+}
+
+void Submit(const std::string &Path, std::function<void()> Job)
+{
+    std::string Key = Core::PathKey(Path);
+
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        Lane &RepositoryLane = Lanes[Key];
+
+        RepositoryLane.Jobs.push_back(std::move(Job));
+        Queued++;
+
+        // A busy lane is re-queued by its worker once the running job finishes.
+        if (RepositoryLane.Busy || RepositoryLane.Jobs.size() > 1)
+            return;
+
+        Ready.push_back(Key);
+    }
+
+    Condition.notify_one();
+}
+
+void SetWorkerCount(size_t Count)
+{
+    std::vector<std::thread> Joining;
+
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+
+        if (Stopping)
+            return;
+
+        TargetWorkers = std::max<size_t>(Count, 1);
+        Joining = TakeExited();
+        SpawnWorkers();
+    }
+
+    Condition.notify_all();
+
+    for (std::thread &Worker : Joining)
+        Worker.join();
+}
+
+size_t GetWorkerCount()
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+    return TargetWorkers;
+}
+
+size_t GetQueueDepth()
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+    return Queued;
+}
+
+size_t GetInFlight()
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+    return InFlight;
+}
+
+size_t GetRepositoryCount()
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+    return Lanes.size();
+}
+
+size_t GetDefaultWorkerCount()
+{
+    size_t Cores = std::thread::hardware_concurrency();
+
+    // Leave at least one core to the srcds main thread.
+    return std::clamp<size_t>(Cores > 1 ? Cores - 1 : 1, 1, 4);
+}
+} // namespace Git::Pool
@@ -0,0 +1,18 @@
+#pragma once
+#include "../includes.h"
+
+namespace Git::Pool
+{
+void Initialize(size_t Workers);
+void Shutdown();
+
+// Jobs sharing a repository path run one at a time in submission order.
+void Submit(const std::string &Path, std::function<void()> Job);
+void SetWorkerCount(size_t Workers);
+
+size_t GetWorkerCount();
+size_t GetQueueDepth();
+size_t GetInFlight();
+size_t GetRepositoryCount();
+size_t GetDefaultWorkerCount();
+} // namespace Git::Pool
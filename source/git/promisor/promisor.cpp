@@ -0,0 +1,458 @@
+#include "promisor.h"
+#include "../logger/logger.h"
+#include "../functions/functions.h"
+#include <git2/sys/odb_backend.h>
+#include <git2/sys/errors.h>
+
+namespace Git::Promisor
+{
+constexpr size_t BATCH_SIZE = 512;
+// How long a failed fetch of an object keeps further lookups of it off the network.
+constexpr int RETRY_SECONDS = 60;
+
+struct OidLess
+{
+    bool operator()(const git_oid &A, const git_oid &B) const
+    {
+        return git_oid_cmp(&A, &B) < 0;
+    }
+};
+
+struct Backend
+{
+    // Must stay the first member, libgit2 hands this pointer back to the callbacks.
+    git_odb_backend Parent;
+    std::string URL;
+    std::string CommonDirectory;
+    std::mutex Mutex;
+    // Objects that could not be fetched and until when lookups of them do not hit the network again. Objects origin
+    // definitely does not have stay here for good, the rest only until the retry time.
+    std::map<git_oid, std::chrono::steady_clock::time_point, OidLess> Unavailable;
+};
+
+static std::atomic<size_t> Scratches{0};
+
+static std::string LocalPath(const std::string &URL)
+{
+    if (URL.compare(0, 7, "file://") == 0)
+        return URL.substr(7);
+
+    std::error_code ErrorCode;
+
+    if (URL.find("://") == std::string::npos && std::filesystem::is_directory(URL, ErrorCode))
+        return URL;
+
+    return std::string();
+}
+
+static std::string OriginURL(git_repository *Repository)
+{
+    git_remote *Remote = nullptr;
+    std::string URL;
+
+    if (git_remote_lookup(&Remote, Repository, "origin") == 0 && git_remote_url(Remote))
+        URL = git_remote_url(Remote);
+
+    git_remote_free(Remote);
+
+    return URL;
+}
+
+// Packs the objects straight out of the other repository's object database.
+static int FetchLocal(const std::string &Source, const std::string &CommonDirectory, const std::vector<git_oid> &Oids)
+{
+    git_repository *SourceRepository = nullptr;
+    git_packbuilder *Builder = nullptr;
+    std::string PackPath = (std::filesystem::path(CommonDirectory) / "objects" / "pack").string();
+
+    int Error = git_repository_open_ext(&SourceRepository, Source.c_str(), GIT_REPOSITORY_OPEN_NO_SEARCH, nullptr);
+
+    if (Error == 0)
+        Error = git_packbuilder_new(&Builder, SourceRepository);
+
+    for (size_t Index = 0; Error == 0 && Index < Oids.size(); ++Index)
+        Error = git_packbuilder_insert(Builder, &Oids[Index], nullptr);
+
+    if (Error == 0)
+        Error = git_packbuilder_write(Builder, PackPath.c_str(), 0, nullptr, nullptr);
+
+    git_packbuilder_free(Builder);
+    git_repository_free(SourceRepository);
+
+    return Error;
+}
+
+// Fetches into an empty scratch repository, so origin cannot send deltas against blobs we never had, then moves
+// the received objects over.
+static int FetchRemote(const std::string &URL, const std::string &CommonDirectory, const std::vector<git_oid> &Oids)
+{
+    std::filesystem::path Objects = std::filesystem::path(CommonDirectory) / "objects";
+    std::filesystem::path Scratch =
+        std::filesystem::path(CommonDirectory) / ("gmsvgit-promisor-" + std::to_string(++Scratches));
+    git_repository *Repository = nullptr;
+    git_remote *Remote = nullptr;
+    git_fetch_options Options = GIT_FETCH_OPTIONS_INIT;
+    GitOperation Fallback(Functions::GetGithubAccessToken(), Dispatcher::NO_CALLBACK);
+    std::vector<std::string> Hashes;
+    std::vector<const char *> RefSpecs;
+
+    for (const git_oid &Oid : Oids)
+        Hashes.push_back(git_oid_tostr_s(&Oid));
+
+    for (const std::string &Hash : Hashes)
+        RefSpecs.push_back(Hash.c_str());
+
+    const git_strarray Wanted = {(char **)RefSpecs.data(), RefSpecs.size()};
+
+    Functions::SetupRemoteCallbacks(Options.callbacks, &Fallback);
+    Options.update_fetchhead = 0;
+    Options.download_tags = GIT_REMOTE_DOWNLOAD_TAGS_NONE;
+
+    // Needs a server that accepts object ids in wants (uploadpack.allowAnySHA1InWant or allowReachableSHA1InWant).
+    int Error = git_repository_init(&Repository, Scratch.string().c_str(), 1);
+
+    if (Error == 0)
+        Error = git_remote_create_anonymous(&Remote, Repository, URL.c_str());
+
+    if (Error == 0)
+        Error = git_remote_fetch(Remote, &Wanted, &Options, nullptr);
+
+    git_remote_free(Remote);
+    git_repository_free(Repository);
+
+    std::error_code ErrorCode;
+
+    for (auto Iterator = std::filesystem::recursive_directory_iterator(Scratch / "objects", ErrorCode);
+         Error == 0 && Iterator != std::filesystem::recursive_directory_iterator(); Iterator.increment(ErrorCode))
+    {
+        std::filesystem::path Relative = Iterator->path().lexically_relative(Scratch / "objects");
+
+        if (Iterator->is_directory() || *Relative.begin() == "info" || std::filesystem::exists(Objects / Relative))
+            continue;
+
+        std::filesystem::create_directories((Objects / Relative).parent_path(), ErrorCode);
+        std::filesystem::rename(Iterator->path(), Objects / Relative, ErrorCode);
+    }
+
+    std::filesystem::remove_all(Scratch, ErrorCode);
+
+    return Error;
+}
+
+static int Fetch(const std::string &URL, const std::string &CommonDirectory, const std::vector<git_oid> &Oids)
+{
+    std::string Source = LocalPath(URL);
+
+    return Source.empty() ? FetchRemote(URL, CommonDirectory, Oids) : FetchLocal(Source, CommonDirectory, Oids);
+}
+
+static int ReadMissing(void **Data, size_t *Size, git_object_t *Type, git_odb_backend *Parent, const git_oid *Oid)
+{
+    Backend *Self = (Backend *)Parent;
+    std::lock_guard<std::mutex> Lock(Self->Mutex);
+
+    auto Known = Self->Unavailable.find(*Oid);
+
+    if (Known != Self->Unavailable.end() && std::chrono::steady_clock::now() < Known->second)
+        return GIT_ENOTFOUND;
+
+    int Error = Fetch(Self->URL, Self->CommonDirectory, {*Oid});
+
+    // A local source without the object is a definite answer, a failed network fetch may well work next time.
+    if (Error != 0)
+    {
+        Self->Unavailable[*Oid] = Error == GIT_ENOTFOUND && !LocalPath(Self->URL).empty()
+                                      ? std::chrono::steady_clock::time_point::max()
+                                      : std::chrono::steady_clock::now() + std::chrono::seconds(RETRY_SECONDS);
+        return GIT_ENOTFOUND;
+    }
+
+    // The repository's own odb is in the middle of this read, so the new object is read through a fresh one.
+    git_odb *Odb = nullptr;
+    git_odb_object *Object = nullptr;
+    std::string Objects = (std::filesystem::path(Self->CommonDirectory) / "objects").string();
+
+    Error = git_odb_open(&Odb, Objects.c_str());
+
+    if (Error == 0)
+        Error = git_odb_read(&Object, Odb, Oid);
+
+    // The fetch went through without bringing the object, origin does not have it.
+    if (Error == GIT_ENOTFOUND)
+        Self->Unavailable[*Oid] = std::chrono::steady_clock::time_point::max();
+    else if (Error == 0)
+        Self->Unavailable.erase(*Oid);
+
+    if (Error == 0)
+    {
+        *Size = git_odb_object_size(Object);
+        *Type = git_odb_object_type(Object);
+        *Data = git_odb_backend_data_alloc(Parent, *Size);
+
+        if (*Data)
+            memcpy(*Data, git_odb_object_data(Object), *Size);
+        else
+            Error = -1;
+    }
+
+    git_odb_object_free(Object);
+    git_odb_free(Odb);
+
+    return Error == 0 ? 0 : GIT_ENOTFOUND;
+}
+
+static void FreeBackend(git_odb_backend *Parent)
+{
+    delete (Backend *)Parent;
+}
+
+bool IsPromisor(git_repository *Repository)
+{
+    git_config *Config = nullptr;
+    git_buf Remote = GIT_BUF_INIT;
+    int Promisor = 0;
+
+    if (git_repository_config_snapshot(&Config, Repository) != 0)
+        return false;
+
+    git_config_get_bool(&Promisor, Config, "remote.origin.promisor");
+
+    // Also set by git itself for clones made with --filter.
+    if (!Promisor && git_config_get_string_buf(&Remote, Config, "extensions.partialclone") == 0)
+        Promisor = strcmp(Remote.ptr, "origin") == 0;
+
+    git_buf_dispose(&Remote);
+    git_config_free(Config);
+
+    return Promisor != 0;
+}
+
+bool IsLocal(const std::string &URL)
+{
+    return !LocalPath(URL).empty();
+}
+
+void Attach(git_repository *Repository)
+{
+    if (!IsPromisor(Repository))
+        return;
+
+    std::string URL = OriginURL(Repository);
+    git_odb *Odb = nullptr;
+
+    if (URL.empty() || git_repository_odb(&Odb, Repository) != 0)
+        return;
+
+    Backend *Self = new Backend();
+
+    git_odb_init_backend(&Self->Parent, GIT_ODB_BACKEND_VERSION);
+    Self->Parent.read = ReadMissing;
+    Self->Parent.free = FreeBackend;
+    Self->URL = URL;
+    Self->CommonDirectory = git_repository_commondir(Repository);
+
+    // Alternates are asked after the repository's own backends, and this one after every other alternate.
+    if (git_odb_add_alternate(Odb, &Self->Parent, -100) != 0)
+        delete Self;
+
+    git_odb_free(Odb);
+}
+
+int Prefetch(git_repository *Repository, git_tree *Target, git_tree *Baseline, const git_strarray *Paths)
+{
+    if (!IsPromisor(Repository))
+        return 0;
+
+    git_diff_options Options = GIT_DIFF_OPTIONS_INIT;
+    git_diff *Diff = nullptr;
+    git_odb *Odb = nullptr;
+    std::set<git_oid, OidLess> Missing;
+
+    if (Paths)
+        Options.pathspec = *Paths;
+
+    int Error = git_repository_odb(&Odb, Repository);
+
+    if (Error == 0)
+        Error = git_diff_tree_to_tree(&Diff, Repository, Baseline, Target, &Options);
+
+    for (size_t Index = 0; Error == 0 && Index < git_diff_num_deltas(Diff); ++Index)
+    {
+        const git_diff_delta *Delta = git_diff_get_delta(Diff, Index);
+
+        if (Delta->status == GIT_DELTA_DELETED || Delta->new_file.mode == GIT_FILEMODE_COMMIT)
+            continue;
+
+        // Skipping the refresh keeps this a pack index lookup instead of a directory scan per missing blob.
+        if (!git_odb_exists_ext(Odb, &Delta->new_file.id, GIT_ODB_LOOKUP_NO_REFRESH))
+            Missing.insert(Delta->new_file.id);
+    }
+
+    git_diff_free(Diff);
+
+    if (Error == 0 && !Missing.empty())
+    {
+        std::string URL = OriginURL(Repository);
+        std::string CommonDirectory = git_repository_commondir(Repository);
+        std::vector<git_oid> Batch;
+
+        Logger::Log(Logger::Info("Fetching {yellow}%zu{white} missing blob%s..."), Missing.size(),
+                    Missing.size() == 1 ? "" : "s");
+
+        for (auto Iterator = Missing.begin(); Error == 0 && Iterator != Missing.end(); ++Iterator)
+        {
+            Batch.push_back(*Iterator);
+
+            if (Batch.size() == BATCH_SIZE || std::next(Iterator) == Missing.end())
+            {
+                Error = Fetch(URL, CommonDirectory, Batch);
+                Batch.clear();
+            }
+        }
+
+        git_odb_refresh(Odb);
+    }
+
+    git_odb_free(Odb);
+
+    return Error;
+}
+
+// Copies a tree and its subtrees into the pack, leaving out every blob.
+static int InsertTree(git_repository *Source, git_packbuilder *Builder, const git_oid *Id,
+                      std::set<git_oid, OidLess> &Seen)
+{
+    if (!Seen.insert(*Id).second)
+        return 0;
+
+    git_tree *Tree = nullptr;
+    int Error = git_tree_lookup(&Tree, Source, Id);
+
+    for (size_t Index = 0; Error == 0 && Index < git_tree_entrycount(Tree); ++Index)
+    {
+        const git_tree_entry *Entry = git_tree_entry_byindex(Tree, Index);
+
+        if (git_tree_entry_type(Entry) == GIT_OBJECT_TREE)
+            Error = InsertTree(Source, Builder, git_tree_entry_id(Entry), Seen);
+    }
+
+    if (Error == 0)
+        Error = git_packbuilder_insert(Builder, Id, nullptr);
+
+    git_tree_free(Tree);
+
+    return Error;
+}
+
+int Clone(git_repository **Out, const std::string &URL, const std::string &Path, bool Bare, const std::string &Branch,
+          bool SingleBranch)
+{
+    std::error_code ErrorCode;
+    std::filesystem::path GitDirectory = Bare ? std::filesystem::path(Path) : std::filesystem::path(Path) / ".git";
+
+    if (std::filesystem::exists(GitDirectory, ErrorCode) && !std::filesystem::is_empty(GitDirectory, ErrorCode))
+    {
+        git_error_set_str(GIT_ERROR_INVALID, ("'" + Path + "' already contains a repository").c_str());
+        return GIT_EEXISTS;
+    }
+
+    git_repository *Source = nullptr, *Repository = nullptr;
+    git_reference *SourceHead = nullptr, *Local = nullptr, *Tracking = nullptr;
+    git_remote *Remote = nullptr;
+    git_revwalk *Walk = nullptr;
+    git_packbuilder *Builder = nullptr;
+    git_commit *Commit = nullptr;
+    git_config *Config = nullptr;
+    std::set<git_oid, OidLess> Seen;
+    std::string Name = Branch;
+    git_oid Head, Current;
+
+    int Error = git_repository_open_ext(&Source, LocalPath(URL).c_str(), GIT_REPOSITORY_OPEN_NO_SEARCH, nullptr);
+
+    if (Error == 0 && Name.empty() && (Error = git_repository_head(&SourceHead, Source)) == 0)
+        Name = git_reference_shorthand(SourceHead);
+
+    std::string BranchRef = "refs/heads/" + Name;
+    std::string TrackingRef = "refs/remotes/origin/" + Name;
+
+    if (Error == 0)
+        Error = git_reference_name_to_id(&Head, Source, BranchRef.c_str());
+
+    if (Error == 0)
+        Error = git_repository_init(&Repository, Path.c_str(), Bare ? 1 : 0);
+
+    if (Error == 0)
+        Error = SingleBranch ? Functions::CreateSingleBranchRemote(&Remote, Repository, "origin", URL.c_str(), &Name)
+                             : git_remote_create(&Remote, Repository, "origin", URL.c_str());
+
+    if (Error == 0)
+        Error = git_packbuilder_new(&Builder, Source);
+
+    if (Error == 0 && (Error = git_revwalk_new(&Walk, Source)) == 0)
+        Error = git_revwalk_push(Walk, &Head);
+
+    while (Error == 0 && git_revwalk_next(&Current, Walk) == 0)
+    {
+        Error = git_commit_lookup(&Commit, Source, &Current);
+
+        if (Error == 0)
+            Error = git_packbuilder_insert(Builder, &Current, nullptr);
+
+        if (Error == 0)
+            Error = InsertTree(Source, Builder, git_commit_tree_id(Commit), Seen);
+
+        git_commit_free(Commit);
+        Commit = nullptr;
+    }
+
+    if (Error == 0)
+        Error = git_packbuilder_write(
+            Builder, (std::filesystem::path(git_repository_commondir(Repository)) / "objects" / "pack").string().c_str(),
+            0, nullptr, nullptr);
+
+    if (Error == 0)
+        Error = git_reference_create(&Tracking, Repository, TrackingRef.c_str(), &Head, 0, "clone: blobless");
+
+    if (Error == 0)
+        Error = git_reference_create(&Local, Repository, BranchRef.c_str(), &Head, 0, "clone: blobless");
+
+    if (Error == 0)
+        Error = git_branch_set_upstream(Local, ("origin/" + Name).c_str());
+
+    if (Error == 0)
+        Error = git_repository_set_head(Repository, BranchRef.c_str());
+
+    // The same markers git writes for --filter=blob:none, so the git CLI lazily fetches in this clone too.
+    if (Error == 0 && (Error = git_repository_config(&Config, Repository)) == 0)
+    {
+        git_config_set_int32(Config, "core.repositoryformatversion", 1);
+        git_config_set_string(Config, "extensions.partialclone", "origin");
+        git_config_set_bool(Config, "remote.origin.promisor", 1);
+        git_config_set_string(Config, "remote.origin.partialclonefilter", "blob:none");
+    }
+
+    if (Error == 0)
+        Attach(Repository);
+
+    git_commit_free(Commit);
+    git_config_free(Config);
+    git_packbuilder_free(Builder);
+    git_revwalk_free(Walk);
+    git_remote_free(Remote);
+    git_reference_free(Local);
+    git_reference_free(Tracking);
+    git_reference_free(SourceHead);
+    git_repository_free(Source);
+
+    if (Error != 0)
+    {
+        git_repository_free(Repository);
+        std::filesystem::remove_all(GitDirectory, ErrorCode);
+        return Error;
+    }
+
+    *Out = Repository;
+
+    return 0;
+}
+} // namespace Git::Promisor
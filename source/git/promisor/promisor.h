@@ -0,0 +1,20 @@
+#pragma once
+#include "../includes.h"
+
+// Blobless clones only hold commits and trees, blobs stay with origin until something needs them.
+// Checkouts prefetch the blobs they are about to write in batches; any other read that misses falls through to an
+// alternate backend that fetches the single object.
+namespace Git::Promisor
+{
+bool IsPromisor(git_repository *Repository);
+bool IsLocal(const std::string &URL);
+void Attach(git_repository *Repository);
+
+// Fetches the missing blobs Target adds or changes compared to Baseline (nullptr for every blob), limited to Paths.
+int Prefetch(git_repository *Repository, git_tree *Target, git_tree *Baseline, const git_strarray *Paths);
+// Copies the commits and trees of one branch of a repository on this host into Path, which may already hold files.
+// The working tree is left to the caller. libgit2 cannot ask a server for a filtered pack, so network remotes are
+// not supported here.
+int Clone(git_repository **Out, const std::string &URL, const std::string &Path, bool Bare, const std::string &Branch,
+          bool SingleBranch);
+} // namespace Git::Promisor
@@ -0,0 +1,226 @@
+#include "reference.h"
+#include "../git/git.h"
+#include <git2/sys/errors.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <cerrno>
+#endif
+
+namespace Git::Reference
+{
+// Two repositories of the same remote must not create or fetch into its mirror at the same time, whether they live
+// in this server or in another instance on the host. The lock is held on <mirror>.lock, which is never removed.
+class MirrorLock
+{
+  public:
+    explicit MirrorLock(const std::string &Mirror)
+    {
+        std::string File = Mirror + ".lock";
+        std::error_code ErrorCode;
+
+        std::filesystem::create_directories(std::filesystem::path(Mirror).parent_path(), ErrorCode);
+
+#ifdef _WIN32
+        OVERLAPPED Overlapped{};
+
+        Handle = CreateFileA(File.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                             OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        Locked = Handle != INVALID_HANDLE_VALUE && LockFileEx(Handle, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &Overlapped);
+#else
+        Fd = open(File.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+
+        while (Fd >= 0 && !Locked)
+            if (flock(Fd, LOCK_EX) == 0)
+                Locked = true;
+            else if (errno != EINTR)
+                break;
+#endif
+    }
+
+    ~MirrorLock()
+    {
+#ifdef _WIN32
+        if (Handle != INVALID_HANDLE_VALUE)
+            CloseHandle(Handle);
+#else
+        // Closing the only descriptor releases the lock.
+        if (Fd >= 0)
+            close(Fd);
+#endif
+    }
+
+    bool IsLocked() const
+    {
+        return Locked;
+    }
+
+  private:
+#ifdef _WIN32
+    HANDLE Handle = INVALID_HANDLE_VALUE;
+#else
+    int Fd = -1;
+#endif
+    bool Locked = false;
+};
+
+std::string Mirror(const std::string &Store, const std::string &URL)
+{
+    git_oid Key;
+
+    git_odb_hash(&Key, URL.data(), URL.size(), GIT_OBJECT_BLOB);
+
+    return (std::filesystem::path(Store) / (std::string(git_oid_tostr_s(&Key)) + ".git")).string();
+}
+
+std::string Location(git_repository *Repository)
+{
+    git_config *Config = nullptr;
+    git_buf Buffer = GIT_BUF_INIT;
+    std::string Mirror;
+
+    if (git_repository_config_snapshot(&Config, Repository) == 0 &&
+        git_config_get_string_buf(&Buffer, Config, GIT_REFERENCE_CONFIG) == 0)
+        Mirror = Buffer.ptr;
+
+    git_buf_dispose(&Buffer);
+    git_config_free(Config);
+
+    return Mirror;
+}
+
+int Update(const std::string &Mirror, const std::string &URL, const git_fetch_options &Options,
+           const std::string &Branch)
+{
+    MirrorLock Lock(Mirror);
+
+    if (!Lock.IsLocked())
+    {
+        git_error_set_str(GIT_ERROR_OS, ("Failed to lock the reference mirror '" + Mirror + "'").c_str());
+        return -1;
+    }
+
+    git_repository *Repository = nullptr;
+    git_remote *Remote = nullptr;
+    git_fetch_options Full = Options;
+    std::string BranchRefSpec = "+refs/heads/" + Branch + ":refs/heads/" + Branch;
+    const char *BranchRefSpecs[] = {BranchRefSpec.c_str()};
+    const git_strarray BranchOnly = {(char **)BranchRefSpecs, 1};
+
+    Full.depth = 0;
+
+    int Error = git_repository_open_ext(&Repository, Mirror.c_str(), GIT_REPOSITORY_OPEN_NO_SEARCH, nullptr);
+
+    if (Error != 0)
+        Error = git_repository_init(&Repository, Mirror.c_str(), 1);
+
+    if (Error == 0 && git_remote_lookup(&Remote, Repository, "origin") != 0)
+        Error =
+            git_remote_create_with_fetchspec(&Remote, Repository, "origin", URL.c_str(), "+refs/heads/*:refs/heads/*");
+
+    if (Error == 0)
+        Error = git_remote_fetch(Remote, Branch.empty() ? nullptr : &BranchOnly, &Full, "fetch: reference");
+
+    git_remote_free(Remote);
+    git_repository_free(Repository);
+
+    return Error;
+}
+
+int Attach(git_repository *Repository, const std::string &Mirror)
+{
+    git_odb *Odb = nullptr;
+    git_config *Config = nullptr;
+    std::string Objects = (std::filesystem::path(Mirror) / "objects").string();
+    std::filesystem::path Alternates =
+        std::filesystem::path(git_repository_commondir(Repository)) / "objects" / "info" / "alternates";
+    std::error_code ErrorCode;
+
+    bool Listed = false;
+
+    {
+        std::ifstream Stream(Alternates);
+        std::string Line;
+
+        while (!Listed && std::getline(Stream, Line))
+            Listed = Line == Objects || Line == Objects + '\r';
+    }
+
+    std::filesystem::create_directories(Alternates.parent_path(), ErrorCode);
+
+    // Attaching again leaves the file and the handle as they are, an entry already in the file was loaded with it.
+    if (!Listed)
+    {
+        std::ofstream Stream(Alternates, std::ios::app);
+
+        Stream << Objects << '\n';
+
+        if (!Stream.good())
+            return -1;
+    }
+
+    // The handle already loaded its object database, the file only covers the next one.
+    int Error = git_repository_odb(&Odb, Repository);
+
+    if (Error == 0 && !Listed)
+        Error = git_odb_add_disk_alternate(Odb, Objects.c_str());
+
+    if (Error == 0 && (Error = git_repository_config(&Config, Repository)) == 0)
+        Error = git_config_set_string(Config, GIT_REFERENCE_CONFIG, Mirror.c_str());
+
+    git_config_free(Config);
+    git_odb_free(Odb);
+
+    return Error;
+}
+
+int Sync(git_repository *Repository, const std::string &Mirror)
+{
+    git_repository *Source = nullptr;
+    git_remote *Origin = nullptr;
+    git_reference_iterator *Iterator = nullptr;
+    git_reference *Branch = nullptr;
+
+    int Error = git_repository_open_ext(&Source, Mirror.c_str(), GIT_REPOSITORY_OPEN_NO_SEARCH, nullptr);
+
+    if (Error == 0)
+        Error = git_remote_lookup(&Origin, Repository, "origin");
+
+    if (Error == 0)
+        Error = git_reference_iterator_glob_new(&Iterator, Source, "refs/heads/*");
+
+    while (Error == 0 && git_reference_next(&Branch, Iterator) == 0)
+    {
+        const char *Name = git_reference_name(Branch);
+        const git_oid *Target = git_reference_target(Branch);
+
+        for (size_t Index = 0; Error == 0 && Target && Index < git_remote_refspec_count(Origin); ++Index)
+        {
+            const git_refspec *RefSpec = git_remote_get_refspec(Origin, Index);
+            git_buf Tracking = GIT_BUF_INIT;
+            git_reference *Updated = nullptr;
+
+            if (git_refspec_direction(RefSpec) != GIT_DIRECTION_FETCH || !git_refspec_src_matches(RefSpec, Name))
+                continue;
+
+            Error = git_refspec_transform(&Tracking, RefSpec, Name);
+
+            if (Error == 0)
+                Error = git_reference_create(&Updated, Repository, Tracking.ptr, Target, 1, "fetch: reference");
+
+            git_reference_free(Updated);
+            git_buf_dispose(&Tracking);
+        }
+
+        git_reference_free(Branch);
+    }
+
+    git_reference_iterator_free(Iterator);
+    git_remote_free(Origin);
+    git_repository_free(Source);
+
+    return Error;
+}
+} // namespace Git::Reference
@@ -0,0 +1,22 @@
+#pragma once
+#include "../includes.h"
+
+// Repositories cloned with a reference borrow their objects from a host-wide bare mirror of the same remote through
+// objects/info/alternates. Fetches update the mirror from the network once and then only move the repository's
+// remote-tracking branches, so every clone of a remote on the host shares one copy of its objects.
+namespace Git::Reference
+{
+// The mirror of URL inside the reference directory Store.
+std::string Mirror(const std::string &Store, const std::string &URL);
+// The mirror this repository borrows from, empty when it has none.
+std::string Location(git_repository *Repository);
+
+// Creates the mirror when needed and fetches every branch of URL into it, or only Branch when it is set. Mirrors
+// always hold the full history, the repositories borrowing from them have no shallow boundary of their own.
+int Update(const std::string &Mirror, const std::string &URL, const git_fetch_options &Options,
+           const std::string &Branch = std::string());
+// Adds the mirror's objects as an alternate and remembers it for later fetches.
+int Attach(git_repository *Repository, const std::string &Mirror);
+// Points the remote-tracking branches of origin at the mirror's branches, through origin's fetch refspecs.
+int Sync(git_repository *Repository, const std::string &Mirror);
+} // namespace Git::Reference
@@ -0,0 +1,149 @@
+#include "snapshot.h"
+#include "../core/core.h"
+
+namespace Git::Snapshot
+{
+using SnapshotMap = std::map<std::string, std::shared_ptr<const GitSnapshot>>;
+
+// Readers still holding a replaced map keep it alive, the last one of them frees it on whichever thread it is.
+static std::shared_ptr<const SnapshotMap> Current;
+static std::mutex WriterMutex;
+
+static void Replace(const std::function<void(SnapshotMap &)> &Update)
+{
+    std::lock_guard<std::mutex> Lock(WriterMutex);
+    std::shared_ptr<const SnapshotMap> Previous = std::atomic_load(&Current);
+    std::shared_ptr<SnapshotMap> Next =
+        Previous ? std::make_shared<SnapshotMap>(*Previous) : std::make_shared<SnapshotMap>();
+
+    Update(*Next);
+    std::atomic_store(&Current, std::shared_ptr<const SnapshotMap>(std::move(Next)));
+}
+
+static int OnStatusEntry(const char *, unsigned int, void *Payload)
+{
+    *(bool *)Payload = true;
+
+    // Any entry is enough to know the tree is dirty.
+    return 1;
+}
+
+void Shutdown()
+{
+    std::lock_guard<std::mutex> Lock(WriterMutex);
+
+    std::atomic_store(&Current, std::shared_ptr<const SnapshotMap>());
+}
+
+std::shared_ptr<const GitSnapshot> Get(const std::string &Path)
+{
+    std::shared_ptr<const SnapshotMap> Map = std::atomic_load(&Current);
+
+    if (!Map)
+        return nullptr;
+
+    auto Iterator = Map->find(Core::PathKey(Path));
+
+    return Iterator != Map->end() ? Iterator->second : nullptr;
+}
+
+std::shared_ptr<const GitSnapshot> Capture(git_repository *Repository, bool IncludeDirty,
+                                           const std::vector<std::string> *Paths)
+{
+    std::shared_ptr<GitSnapshot> Snapshot = std::make_shared<GitSnapshot>();
+    git_reference *Head = nullptr;
+    git_oid HeadOid, UpstreamOid;
+    bool HasHead = false, HasUpstream = false;
+
+    if (git_repository_head(&Head, Repository) == 0)
+    {
+        const char *BranchName = "HEAD";
+
+        if (git_reference_is_branch(Head))
+            git_branch_name(&BranchName, Head);
+
+        Snapshot->Branch = BranchName;
+
+        if (const git_oid *Target = git_reference_target(Head))
+        {
+            git_oid_cpy(&HeadOid, Target);
+            HasHead = true;
+
+            Snapshot->Hash = git_oid_tostr_s(&HeadOid);
+            Snapshot->ShortHash = Snapshot->Hash.substr(0, 7);
+        }
+
+        git_reference *Upstream = nullptr;
+
+        if (git_reference_is_branch(Head) && git_branch_upstream(&Upstream, Head) == 0 &&
+            git_reference_name_to_id(&UpstreamOid, Repository, git_reference_name(Upstream)) == 0)
+            HasUpstream = true;
+        else if (git_reference_is_branch(Head) &&
+                 git_reference_name_to_id(&UpstreamOid, Repository,
+                                          (std::string("refs/remotes/origin/") + BranchName).c_str()) == 0)
+            HasUpstream = true;
+
+        if (HasUpstream)
+            Snapshot->Upstream = git_oid_tostr_s(&UpstreamOid);
+
+        git_reference_free(Upstream);
+    }
+
+    git_reference_free(Head);
+
+    if (IncludeDirty)
+    {
+        if (HasHead && HasUpstream)
+            git_graph_ahead_behind(&Snapshot->Ahead, &Snapshot->Behind, Repository, &HeadOid, &UpstreamOid);
+
+        git_status_options Options = GIT_STATUS_OPTIONS_INIT;
+        std::vector<const char *> Pathspec;
+        Options.show = GIT_STATUS_SHOW_INDEX_AND_WORKDIR;
+        Options.flags = GIT_STATUS_OPT_EXCLUDE_SUBMODULES;
+
+        if (Paths)
+        {
+            for (const std::string &File : *Paths)
+                Pathspec.push_back(File.c_str());
+
+            // Exact paths let the status walk skip every directory that holds none of them.
+            Options.flags |= GIT_STATUS_OPT_DISABLE_PATHSPEC_MATCH;
+            Options.pathspec = git_strarray{(char **)Pathspec.data(), Pathspec.size()};
+        }
+
+        if (!Paths || !Paths->empty())
+            git_status_foreach_ext(Repository, &Options, OnStatusEntry, &Snapshot->Dirty);
+
+        Snapshot->Complete = true;
+    }
+
+    return Snapshot;
+}
+
+void Publish(const std::string &Path, const std::shared_ptr<const GitSnapshot> &Snapshot)
+{
+    std::string Key = Core::PathKey(Path);
+
+    Replace([&](SnapshotMap &Map) { Map[Key] = Snapshot; });
+}
+
+std::shared_ptr<const GitSnapshot> Refresh(const std::string &Path, git_repository *Repository,
+                                           const std::vector<std::string> *Touched)
+{
+    std::shared_ptr<const GitSnapshot> Previous = Touched ? Get(Path) : nullptr;
+    // Only a clean tree carries over, whether a dirty one still is takes a look at every path.
+    bool Partial = Previous && Previous->Complete && !Previous->Dirty;
+    std::shared_ptr<const GitSnapshot> Snapshot = Capture(Repository, true, Partial ? Touched : nullptr);
+
+    Publish(Path, Snapshot);
+
+    return Snapshot;
+}
+
+void Invalidate(const std::string &Path)
+{
+    std::string Key = Core::PathKey(Path);
+
+    Replace([&](SnapshotMap &Map) { Map.erase(Key); });
+}
+} // namespace Git::Snapshot
@@ -0,0 +1,31 @@
+#pragma once
+#include "../includes.h"
+
+struct GitSnapshot
+{
+    std::string Branch;
+    std::string Hash;
+    std::string ShortHash;
+    std::string Upstream;
+    size_t Ahead = 0;
+    size_t Behind = 0;
+    bool Dirty = false;
+    // Dirty, Ahead and Behind are only filled in by a full capture.
+    bool Complete = false;
+};
+
+// Snapshots are published copy-on-write: readers never take the writer lock, workers replace them.
+namespace Git::Snapshot
+{
+void Shutdown();
+
+std::shared_ptr<const GitSnapshot> Get(const std::string &Path);
+// With Paths, the dirty check only looks at those paths.
+std::shared_ptr<const GitSnapshot> Capture(git_repository *Repository, bool IncludeDirty,
+                                           const std::vector<std::string> *Paths = nullptr);
+void Publish(const std::string &Path, const std::shared_ptr<const GitSnapshot> &Snapshot);
+// With Touched, the paths an operation changed, a clean snapshot is only checked again at those paths.
+std::shared_ptr<const GitSnapshot> Refresh(const std::string &Path, git_repository *Repository,
+                                           const std::vector<std::string> *Touched = nullptr);
+void Invalidate(const std::string &Path);
+} // namespace Git::Snapshot
@@ -0,0 +1,188 @@
+#include "sparse.h"
+#include "../core/core.h"
+#include "../promisor/promisor.h"
+#include <git2/sys/errors.h>
+
+namespace Git::Sparse
+{
+static int OnPattern(const git_config_entry *Entry, void *Payload)
+{
+    ((std::vector<std::string> *)Payload)->push_back(Entry->value);
+
+    return 0;
+}
+
+git_tree *Subtree(git_repository *Repository, git_tree *Tree, const std::string &Root)
+{
+    git_tree *Result = nullptr;
+
+    if (!Tree)
+        return nullptr;
+
+    if (Root.empty())
+    {
+        git_tree_dup(&Result, Tree);
+        return Result;
+    }
+
+    git_tree_entry *Entry = nullptr;
+
+    if (git_tree_entry_bypath(&Entry, Tree, Root.c_str()) == 0 && git_tree_entry_type(Entry) == GIT_OBJECT_TREE)
+        git_tree_lookup(&Result, Repository, git_tree_entry_id(Entry));
+
+    git_tree_entry_free(Entry);
+
+    return Result;
+}
+
+static git_strarray ToStrArray(const std::vector<std::string> &Patterns, std::vector<const char *> &Storage)
+{
+    Storage.clear();
+
+    for (const std::string &Pattern : Patterns)
+        Storage.push_back(Pattern.c_str());
+
+    return git_strarray{(char **)Storage.data(), Storage.size()};
+}
+
+bool Load(git_repository *Repository, GitSparseOptions &Options)
+{
+    git_config *Config = nullptr;
+    git_buf Root = GIT_BUF_INIT;
+    bool Found = false;
+
+    if (!git_repository_is_bare(Repository) || git_repository_config_snapshot(&Config, Repository) != 0)
+        return false;
+
+    if (git_config_get_string_buf(&Root, Config, GIT_ROOT_CONFIG) == 0)
+    {
+        Found = true;
+        Options.Root = Root.ptr;
+        Options.Patterns.clear();
+        git_config_get_multivar_foreach(Config, GIT_SPARSE_CONFIG, nullptr, OnPattern, &Options.Patterns);
+    }
+
+    git_buf_dispose(&Root);
+    git_config_free(Config);
+
+    return Found;
+}
+
+void Save(git_repository *Repository, const GitSparseOptions &Options)
+{
+    git_config *Config = nullptr;
+
+    if (git_repository_config(&Config, Repository) != 0)
+        return;
+
+    git_config_set_string(Config, GIT_ROOT_CONFIG, Options.Root.c_str());
+    git_config_delete_multivar(Config, GIT_SPARSE_CONFIG, ".*");
+
+    // "^$" never matches an existing value, so every pattern is appended.
+    for (const std::string &Pattern : Options.Patterns)
+        git_config_set_multivar(Config, GIT_SPARSE_CONFIG, "^$", Pattern.c_str());
+
+    git_config_free(Config);
+}
+
+std::string NormalizeRoot(const std::string &Root)
+{
+    std::string Result = std::filesystem::path(Root).lexically_normal().generic_string();
+
+    while (!Result.empty() && Result.front() == '/')
+        Result.erase(0, 1);
+
+    while (!Result.empty() && Result.back() == '/')
+        Result.pop_back();
+
+    return Result == "." ? std::string() : Result;
+}
+
+int Write(git_repository *Repository, const std::string &Path, const GitSparseOptions &Options, git_tree *Target,
+          git_tree *Baseline, git_checkout_options &CheckoutOptions)
+{
+    git_tree *TargetRoot = Subtree(Repository, Target, Options.Root);
+
+    if (!TargetRoot)
+    {
+        git_error_set_str(GIT_ERROR_TREE, ("Deployment root '" + Options.Root + "' does not exist").c_str());
+        return GIT_ENOTFOUND;
+    }
+
+    git_tree *BaselineRoot = Subtree(Repository, Baseline, Options.Root);
+    git_index *Empty = nullptr;
+    std::vector<const char *> Storage;
+
+    // Without a baseline libgit2 compares against the HEAD tree, which is not remapped.
+    if (!BaselineRoot && git_index_new(&Empty) != 0)
+    {
+        git_tree_free(TargetRoot);
+        return -1;
+    }
+
+    CheckoutOptions.checkout_strategy |= GIT_CHECKOUT_RECREATE_MISSING | GIT_CHECKOUT_DONT_UPDATE_INDEX;
+    CheckoutOptions.paths = ToStrArray(Options.Patterns, Storage);
+    CheckoutOptions.baseline = BaselineRoot;
+    CheckoutOptions.baseline_index = Empty;
+    CheckoutOptions.target_directory = Path.c_str();
+
+    // Missing files are recreated even when they did not change, so every matching blob has to be present.
+    int Error = Promisor::Prefetch(Repository, TargetRoot, nullptr, &CheckoutOptions.paths);
+
+    if (Error == 0)
+        Error = git_checkout_tree(Repository, (git_object *)TargetRoot, &CheckoutOptions);
+
+    CheckoutOptions.paths = git_strarray{nullptr, 0};
+    CheckoutOptions.baseline = nullptr;
+    CheckoutOptions.baseline_index = nullptr;
+    CheckoutOptions.target_directory = nullptr;
+
+    git_index_free(Empty);
+    git_tree_free(BaselineRoot);
+    git_tree_free(TargetRoot);
+
+    return Error;
+}
+
+void Prune(git_repository *Repository, const std::string &Path, const GitSparseOptions &Previous,
+           const GitSparseOptions &Current, git_tree *Tree)
+{
+    git_tree *Root = Subtree(Repository, Tree, Previous.Root);
+    git_pathspec *PreviousSpec = nullptr, *CurrentSpec = nullptr;
+    git_pathspec_match_list *Matches = nullptr;
+    std::vector<const char *> PreviousStorage, CurrentStorage;
+    git_strarray PreviousPatterns = ToStrArray(Previous.Patterns, PreviousStorage);
+    git_strarray CurrentPatterns = ToStrArray(Current.Patterns, CurrentStorage);
+
+    if (Root && git_pathspec_new(&PreviousSpec, &PreviousPatterns) == 0 &&
+        git_pathspec_new(&CurrentSpec, &CurrentPatterns) == 0 &&
+        git_pathspec_match_tree(&Matches, Root, GIT_PATHSPEC_DEFAULT, PreviousSpec) == 0)
+    {
+        std::filesystem::path Destination(Core::PathKey(Path));
+
+        for (size_t Index = 0; Index < git_pathspec_match_list_entrycount(Matches); ++Index)
+        {
+            const char *Entry = git_pathspec_match_list_entry(Matches, Index);
+
+            if (git_pathspec_matches_path(CurrentSpec, GIT_PATHSPEC_DEFAULT, Entry))
+                continue;
+
+            std::error_code ErrorCode;
+            std::filesystem::path File = Destination / Entry;
+
+            std::filesystem::remove(File, ErrorCode);
+
+            // Drop directories left empty, but never the destination itself.
+            for (std::filesystem::path Parent = File.parent_path(); Parent != Destination && !Parent.empty();
+                 Parent = Parent.parent_path())
+                if (!std::filesystem::remove(Parent, ErrorCode))
+                    break;
+        }
+    }
+
+    git_pathspec_match_list_free(Matches);
+    git_pathspec_free(CurrentSpec);
+    git_pathspec_free(PreviousSpec);
+    git_tree_free(Root);
+}
+} // namespace Git::Sparse
@@ -0,0 +1,22 @@
+#pragma once
+#include "../includes.h"
+#include "../git/git.h"
+
+// A sparse deployment is a bare repository in <destination>/.git whose files are written straight into the
+// destination with a tree-to-tree checkout, limited to the patterns and remapped below the root.
+namespace Git::Sparse
+{
+bool Load(git_repository *Repository, GitSparseOptions &Options);
+void Save(git_repository *Repository, const GitSparseOptions &Options);
+std::string NormalizeRoot(const std::string &Root);
+// Returns the tree the destination maps to, or nullptr when Root does not exist in Tree.
+git_tree *Subtree(git_repository *Repository, git_tree *Tree, const std::string &Root);
+
+// Brings the destination from Baseline (nullptr for an empty destination) to Target. The caller picks the
+// strategy and callbacks, the paths, baseline and target directory are filled in here.
+int Write(git_repository *Repository, const std::string &Path, const GitSparseOptions &Options, git_tree *Target,
+          git_tree *Baseline, git_checkout_options &CheckoutOptions);
+// Deletes the files of Tree that Previous wrote but Current no longer matches.
+void Prune(git_repository *Repository, const std::string &Path, const GitSparseOptions &Previous,
+           const GitSparseOptions &Current, git_tree *Tree);
+} // namespace Git::Sparse
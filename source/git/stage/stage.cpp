@@ -0,0 +1,861 @@
+#include "stage.h"
+#include "../core/core.h"
+#include "../operation/operation.h"
+#include "../sparse/sparse.h"
+#include "../promisor/promisor.h"
+#include "../swap/swap.h"
+#include "../copy/copy.h"
+#include "../batch/batch.h"
+#include "../store/store.h"
+#include <git2/sys/errors.h>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+namespace Git::Stage
+{
+struct FileState
+{
+    bool Exists = false;
+    uintmax_t Size = 0;
+    std::filesystem::file_time_type Time;
+
+    bool operator==(const FileState &Other) const
+    {
+        return Exists == Other.Exists && Size == Other.Size && Time == Other.Time;
+    }
+};
+
+struct Change
+{
+    std::string Path;
+    // Empty when the path is removed.
+    std::string Staged;
+    FileState State;
+    uint32_t Mode = 0;
+    git_oid Id;
+};
+
+struct Plan
+{
+    std::string Directory;
+    std::string Destination;
+    std::string BranchRef;
+    git_oid Old;
+    git_oid Target;
+    std::vector<Change> Changes;
+    // Files an initial checkout found already in place, they are only indexed.
+    std::vector<std::string> Unchanged;
+    // Swap the whole working tree instead of writing into it.
+    bool Atomic = false;
+    // Deployments have no index of their own.
+    bool Indexed = false;
+};
+
+// Staging threads per update, each holds its own repository handle.
+constexpr size_t MAX_STAGE_WORKERS = 8;
+// Updates with fewer files than this per thread are not worth spreading out.
+constexpr size_t STAGE_BATCH = 64;
+// Inflated file contents a staging thread holds before writing them out.
+constexpr size_t MAX_PENDING_BYTES = 16 * 1024 * 1024;
+
+static std::mutex Mutex;
+static std::map<std::string, Plan> Plans;
+
+// The files the last update replaced, kept as a plan that undoes it.
+static std::filesystem::path Rollback(git_repository *Repository)
+{
+    return std::filesystem::path(git_repository_path(Repository)) / "gmsvgit-rollback";
+}
+
+static FileState Stat(const std::filesystem::path &File)
+{
+    FileState State;
+    std::error_code ErrorCode;
+    std::filesystem::file_status Status = std::filesystem::symlink_status(File, ErrorCode);
+
+    if (ErrorCode || !std::filesystem::exists(Status))
+        return State;
+
+    State.Exists = true;
+
+    if (std::filesystem::is_regular_file(Status))
+        State.Size = std::filesystem::file_size(File, ErrorCode);
+
+    if (!std::filesystem::is_symlink(Status))
+        State.Time = std::filesystem::last_write_time(File, ErrorCode);
+
+    return State;
+}
+
+// Whether the file on disk still holds the blob the old tree recorded for it.
+static bool Unmodified(git_repository *Repository, const std::filesystem::path &File, const git_diff_file &Old,
+                       const char *RelativePath)
+{
+    git_oid Oid;
+    std::error_code ErrorCode;
+
+    if (Old.mode == GIT_FILEMODE_LINK)
+    {
+        std::string Link = std::filesystem::read_symlink(File, ErrorCode).generic_string();
+
+        return !ErrorCode && git_odb_hash(&Oid, Link.data(), Link.size(), GIT_OBJECT_BLOB) == 0 &&
+               git_oid_equal(&Oid, &Old.id);
+    }
+
+    return git_repository_hashfile(&Oid, Repository, File.string().c_str(), GIT_OBJECT_BLOB, RelativePath) == 0 &&
+           git_oid_equal(&Oid, &Old.id);
+}
+
+static int Fail(const std::string &Message)
+{
+    git_error_set_str(GIT_ERROR_CHECKOUT, Message.c_str());
+
+    return -1;
+}
+
+// A file can only replace a directory the plan's own removals empty, anything else in it would be lost or make the
+// move fail halfway through the apply.
+static int CheckDirectories(const Plan &Current)
+{
+    std::set<std::string> Removed;
+
+    for (const Change &Entry : Current.Changes)
+        if (Entry.Staged.empty())
+            Removed.insert(Entry.Path);
+
+    for (const Change &Entry : Current.Changes)
+    {
+        if (Entry.Staged.empty())
+            continue;
+
+        std::filesystem::path File = std::filesystem::path(Current.Destination) / Entry.Path;
+        std::error_code ErrorCode;
+
+        // The same goes for a file where the new one needs a directory.
+        for (std::filesystem::path Parent = std::filesystem::path(Entry.Path).parent_path(); !Parent.empty();
+             Parent = Parent.parent_path())
+        {
+            std::filesystem::file_status Status =
+                std::filesystem::symlink_status(std::filesystem::path(Current.Destination) / Parent, ErrorCode);
+
+            if (std::filesystem::exists(Status) && !std::filesystem::is_directory(Status) &&
+                !Removed.count(Parent.generic_string()))
+                return Fail("Untracked file '" + Parent.generic_string() + "' would be overwritten");
+        }
+
+        if (!Entry.State.Exists || !std::filesystem::is_directory(std::filesystem::symlink_status(File, ErrorCode)))
+            continue;
+
+        for (std::filesystem::recursive_directory_iterator Iterator(File, ErrorCode), End;
+             !ErrorCode && Iterator != End; Iterator.increment(ErrorCode))
+        {
+            std::error_code EntryError;
+
+            if (Iterator->is_directory(EntryError) && !Iterator->is_symlink(EntryError))
+                continue;
+
+            std::string Relative = Iterator->path().lexically_relative(Current.Destination).generic_string();
+
+            if (!Removed.count(Relative))
+                return Fail("Untracked file '" + Relative + "' would be overwritten");
+        }
+
+        if (ErrorCode)
+            return Fail("Failed to read the directory '" + Entry.Path + "'");
+    }
+
+    return 0;
+}
+
+// Symlinks are created right away, file contents are queued on Pending and written in batches.
+static int StageBlob(git_repository *Repository, const Change &Entry, std::vector<Batch::File> &Pending)
+{
+    git_blob *Blob = nullptr;
+    std::error_code ErrorCode;
+
+    int Error = git_blob_lookup(&Blob, Repository, &Entry.Id);
+
+    if (Error != 0)
+        return Error;
+
+    if (Entry.Mode == GIT_FILEMODE_LINK)
+    {
+        std::string Link((const char *)git_blob_rawcontent(Blob), (size_t)git_blob_rawsize(Blob));
+
+        std::filesystem::create_symlink(Link, Entry.Staged, ErrorCode);
+        git_blob_free(Blob);
+
+        return ErrorCode ? -1 : 0;
+    }
+
+    git_buf Content = GIT_BUF_INIT;
+    git_blob_filter_options Options = GIT_BLOB_FILTER_OPTIONS_INIT;
+
+    Error = git_blob_filter(&Content, Blob, Entry.Path.c_str(), &Options);
+
+    if (Error == 0)
+        Pending.push_back({Entry.Staged, std::string(Content.ptr, Content.size),
+                           Entry.Mode == GIT_FILEMODE_BLOB_EXECUTABLE});
+
+    git_buf_dispose(&Content);
+    git_blob_free(Blob);
+
+    return Error;
+}
+
+// Inflates and writes the staged files on several threads, each with its own repository handle since one handle
+// cannot be shared. Errors are thread local in libgit2, so the first one is carried back to the calling thread.
+static int StageBlobs(git_repository *Repository, Plan &Current, const std::vector<size_t> &Jobs,
+                      const std::string &BlobStore, GitOperation &Operation)
+{
+    size_t Workers = std::min({(size_t)std::max(std::thread::hardware_concurrency(), 1u), MAX_STAGE_WORKERS,
+                               Jobs.size() / STAGE_BATCH + 1});
+    std::atomic<size_t> Next{0};
+    std::atomic<bool> Failed{false};
+    std::mutex ErrorMutex;
+    std::string Message;
+
+    auto Report = [&](const std::string &Reason) {
+        std::lock_guard<std::mutex> Lock(ErrorMutex);
+
+        if (!Failed.exchange(true))
+            Message = Reason;
+    };
+
+    auto Work = [&](git_repository *Handle) {
+        std::vector<Batch::File> Pending;
+        size_t PendingBytes = 0;
+
+        for (size_t Job = Next++; Job < Jobs.size() && !Failed; Job = Next++)
+        {
+            const Change &Entry = Current.Changes[Jobs[Job]];
+
+            size_t Queued = Pending.size();
+
+            if (Operation.Cancelled())
+            {
+                Report("Checkout was cancelled");
+                return;
+            }
+
+            if (!BlobStore.empty() && Store::Link(Handle, BlobStore, Entry.Id, Entry.Mode, Entry.Path, Entry.Staged))
+            {
+                Operation.Touch();
+                Operation.CheckoutSteps++;
+                continue;
+            }
+
+            if (StageBlob(Handle, Entry, Pending) != 0)
+            {
+                const git_error *Error = git_error_last();
+
+                Report(Error && Error->message ? Error->message : "Failed to stage '" + Entry.Path + "'");
+                return;
+            }
+
+            Operation.Touch();
+            Operation.CheckoutSteps++;
+
+            if (Pending.size() > Queued)
+                PendingBytes += Pending.back().Content.size();
+
+            // Bounds the memory held by inflated blobs waiting for their batch.
+            if (Pending.size() < Batch::QUEUE_DEPTH && PendingBytes < MAX_PENDING_BYTES)
+                continue;
+
+            if (!Batch::Write(Pending))
+            {
+                Report("Failed to write the staged files");
+                return;
+            }
+
+            Pending.clear();
+            PendingBytes = 0;
+        }
+
+        if (!Failed && !Batch::Write(Pending))
+            Report("Failed to write the staged files");
+    };
+
+    std::vector<git_repository *> Handles;
+    std::vector<std::thread> Threads;
+
+    for (size_t Index = 1; Index < Workers; ++Index)
+    {
+        git_repository *Handle = nullptr;
+
+        if (git_repository_open_ext(&Handle, git_repository_path(Repository), GIT_REPOSITORY_OPEN_NO_SEARCH, nullptr) !=
+            0)
+        {
+            git_repository_free(Handle);
+            break;
+        }
+
+        Promisor::Attach(Handle);
+        Handles.push_back(Handle);
+        Threads.emplace_back(Work, Handle);
+    }
+
+    Work(Repository);
+
+    for (std::thread &Thread : Threads)
+        Thread.join();
+
+    for (git_repository *Handle : Handles)
+        git_repository_free(Handle);
+
+    return Failed ? Fail(Message) : 0;
+}
+
+void Discard(const std::string &Path)
+{
+    std::string Directory;
+
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        auto Iterator = Plans.find(Core::PathKey(Path));
+
+        if (Iterator == Plans.end())
+            return;
+
+        Directory = Iterator->second.Directory;
+        Plans.erase(Iterator);
+    }
+
+    std::error_code ErrorCode;
+    std::filesystem::remove_all(Directory, ErrorCode);
+}
+
+std::vector<std::string> Changes(const std::string &Path)
+{
+    std::vector<std::string> Paths;
+    std::lock_guard<std::mutex> Lock(Mutex);
+    auto Iterator = Plans.find(Core::PathKey(Path));
+
+    if (Iterator != Plans.end())
+        for (const Change &Entry : Iterator->second.Changes)
+            Paths.push_back(Entry.Path);
+
+    return Paths;
+}
+
+bool IsPrepared(const std::string &Path)
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+
+    return Plans.count(Core::PathKey(Path)) > 0;
+}
+
+GitCodes Prepare(git_repository *Repository, const std::string &Path, const git_oid &Old, const git_oid &Target,
+                 const std::string &BranchRef, bool Atomic, GitOperation &Operation)
+{
+    Discard(Path);
+
+    GitSparseOptions Deployment;
+    bool IsDeployment = Sparse::Load(Repository, Deployment);
+    bool Initial = git_oid_is_zero(&Old);
+    git_commit *OldCommit = nullptr, *TargetCommit = nullptr;
+    git_tree *OldTree = nullptr, *TargetTree = nullptr, *OldRoot = nullptr, *TargetRoot = nullptr;
+    git_diff *Diff = nullptr;
+    git_diff_options DiffOptions = GIT_DIFF_OPTIONS_INIT;
+    std::vector<const char *> Patterns;
+
+    Plan Result;
+    Result.Directory = (std::filesystem::path(git_repository_path(Repository)) / "gmsvgit-stage").string();
+    Result.Destination = IsDeployment ? Core::PathKey(Path) : std::string(git_repository_workdir(Repository));
+    Result.BranchRef = BranchRef;
+    Result.Old = Old;
+    Result.Target = Target;
+    Result.Atomic = Atomic;
+    Result.Indexed = !IsDeployment;
+
+    std::error_code ErrorCode;
+    std::filesystem::remove_all(Result.Directory, ErrorCode);
+
+    if (!std::filesystem::create_directories(Result.Directory, ErrorCode))
+        return GitCodes::CHECKOUT_FAILED;
+
+    if ((!Initial && (git_commit_lookup(&OldCommit, Repository, &Old) != 0 ||
+                      git_commit_tree(&OldTree, OldCommit) != 0)) ||
+        git_commit_lookup(&TargetCommit, Repository, &Target) != 0 ||
+        git_commit_tree(&TargetTree, TargetCommit) != 0)
+    {
+        git_tree_free(OldTree);
+        git_tree_free(TargetTree);
+        git_commit_free(OldCommit);
+        git_commit_free(TargetCommit);
+        std::filesystem::remove_all(Result.Directory, ErrorCode);
+
+        return GitCodes::TREE_LOOKUP_FAILED;
+    }
+
+    // A deployment diffs below its root, so every delta path is already relative to the destination.
+    OldRoot = IsDeployment ? Sparse::Subtree(Repository, OldTree, Deployment.Root) : OldTree;
+    TargetRoot = IsDeployment ? Sparse::Subtree(Repository, TargetTree, Deployment.Root) : TargetTree;
+
+    for (const std::string &Pattern : Deployment.Patterns)
+        Patterns.push_back(Pattern.c_str());
+
+    DiffOptions.pathspec = git_strarray{(char **)Patterns.data(), Patterns.size()};
+
+    int Error = TargetRoot ? 0 : Fail("Deployment root '" + Deployment.Root + "' does not exist");
+
+    if (Error == 0)
+        Error = Promisor::Prefetch(Repository, TargetRoot, OldRoot, &DiffOptions.pathspec);
+
+    if (Error == 0)
+        Error = git_diff_tree_to_tree(&Diff, Repository, OldRoot, TargetRoot, &DiffOptions);
+
+    size_t Count = Error == 0 ? git_diff_num_deltas(Diff) : 0;
+    std::vector<size_t> Jobs;
+
+    Operation.EnterPhase(GitOperationPhase::CHECKOUT);
+
+    for (size_t Index = 0; Error == 0 && Index < Count; ++Index)
+    {
+        const git_diff_delta *Delta = git_diff_get_delta(Diff, Index);
+        bool Removed = Delta->status == GIT_DELTA_DELETED;
+        const git_diff_file &Side = Removed ? Delta->old_file : Delta->new_file;
+
+        if (Operation.Cancelled())
+        {
+            Error = Fail("Checkout was cancelled");
+            break;
+        }
+
+        Operation.Touch();
+
+        // Submodules are left to the user, like the regular checkout does.
+        if (Side.mode == GIT_FILEMODE_COMMIT)
+            continue;
+
+        Change Entry;
+        Entry.Path = Side.path;
+        Entry.Mode = Removed ? 0 : Delta->new_file.mode;
+        Entry.Id = Delta->new_file.id;
+
+        std::filesystem::path File = std::filesystem::path(Result.Destination) / Entry.Path;
+        Entry.State = Stat(File);
+
+        bool Tracked = Delta->status != GIT_DELTA_ADDED && Delta->old_file.mode != GIT_FILEMODE_COMMIT;
+
+        // A clone over a previous copy of the same files only writes the ones that differ.
+        if (Initial && Entry.State.Exists && Unmodified(Repository, File, Delta->new_file, Delta->new_file.path))
+        {
+            Result.Unchanged.push_back(Entry.Path);
+            continue;
+        }
+
+        // The same paths a safe checkout refuses to overwrite: local edits and untracked files in the way. A clone
+        // into an existing directory replaces the files its tree tracks, like a copy over it would. Directories in
+        // the way are checked once every removal is known.
+        if (Entry.State.Exists && Tracked && !Unmodified(Repository, File, Delta->old_file, Delta->old_file.path))
+            Error = Fail("Local changes to '" + Entry.Path + "' would be overwritten");
+        else if (Entry.State.Exists && !Tracked && !Initial && !std::filesystem::is_directory(File, ErrorCode))
+            Error = Fail("Untracked file '" + Entry.Path + "' would be overwritten");
+
+        if (!Removed)
+        {
+            Entry.Staged = (std::filesystem::path(Result.Directory) / std::to_string(Index)).string();
+            Jobs.push_back(Result.Changes.size());
+        }
+
+        Result.Changes.push_back(std::move(Entry));
+    }
+
+    if (Error == 0)
+        Error = CheckDirectories(Result);
+
+    Operation.CheckoutSteps.store(0);
+    Operation.TotalCheckoutSteps.store(Jobs.size());
+
+    if (Error == 0)
+        Error = StageBlobs(Repository, Result, Jobs, Store::Location(Repository), Operation);
+
+    git_diff_free(Diff);
+
+    if (IsDeployment)
+    {
+        git_tree_free(OldRoot);
+        git_tree_free(TargetRoot);
+    }
+
+    git_tree_free(OldTree);
+    git_tree_free(TargetTree);
+    git_commit_free(OldCommit);
+    git_commit_free(TargetCommit);
+
+    if (Error != 0)
+    {
+        std::filesystem::remove_all(Result.Directory, ErrorCode);
+        return GitCodes::CHECKOUT_FAILED;
+    }
+
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Plans[Core::PathKey(Path)] = std::move(Result);
+
+    return GitCodes::PREPARE_SUCCESS;
+}
+
+// Renames within one filesystem, the staging directory only lives elsewhere when the git dir was moved out.
+static bool Move(const std::filesystem::path &From, const std::filesystem::path &To)
+{
+    std::error_code ErrorCode;
+
+    std::filesystem::rename(From, To, ErrorCode);
+
+    if (!ErrorCode)
+        return true;
+
+    return Copy::File(From, To);
+}
+
+// Drops the directories a removal left empty, but never Root itself.
+static void PruneParents(const std::filesystem::path &File, const std::filesystem::path &Root)
+{
+    std::error_code ErrorCode;
+
+    for (std::filesystem::path Parent = File.parent_path(); Parent != Root && !Parent.empty();
+         Parent = Parent.parent_path())
+        if (!std::filesystem::remove(Parent, ErrorCode))
+            break;
+}
+
+// Moves every staged file below Root, removals go first since a file may replace a directory of removed files.
+static bool WriteChanges(const Plan &Current, const std::filesystem::path &Root)
+{
+    std::error_code ErrorCode;
+
+    for (const Change &Entry : Current.Changes)
+    {
+        if (!Entry.Staged.empty())
+            continue;
+
+        std::filesystem::remove(Root / Entry.Path, ErrorCode);
+        PruneParents(Root / Entry.Path, Root);
+    }
+
+    std::set<std::filesystem::path> Directories;
+
+    for (const Change &Entry : Current.Changes)
+    {
+        if (Entry.Staged.empty())
+            continue;
+
+        // A directory the removals emptied has to go first, a file in the way is replaced by the rename below.
+        if (std::filesystem::is_directory(std::filesystem::symlink_status(Root / Entry.Path, ErrorCode)))
+            std::filesystem::remove(Root / Entry.Path, ErrorCode);
+
+        Directories.insert((Root / Entry.Path).parent_path());
+    }
+
+    for (const std::filesystem::path &Directory : Directories)
+        std::filesystem::create_directories(Directory, ErrorCode);
+
+    for (const Change &Entry : Current.Changes)
+    {
+        if (Entry.Staged.empty())
+            continue;
+
+        std::filesystem::path File = Root / Entry.Path;
+
+        if (!Move(Entry.Staged, File))
+        {
+            git_error_set_str(GIT_ERROR_OS, ("Failed to write '" + Entry.Path + "'").c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Copies the stat data of a file that was just written, so the next status does not have to hash it again.
+static void FillStat(git_index_entry &Entry, const std::filesystem::path &File)
+{
+#ifndef _WIN32
+    struct stat Info;
+
+    if (lstat(File.c_str(), &Info) != 0)
+        return;
+
+    Entry.ctime.seconds = (int32_t)Info.st_ctim.tv_sec;
+    Entry.ctime.nanoseconds = (uint32_t)Info.st_ctim.tv_nsec;
+    Entry.mtime.seconds = (int32_t)Info.st_mtim.tv_sec;
+    Entry.mtime.nanoseconds = (uint32_t)Info.st_mtim.tv_nsec;
+    Entry.dev = (uint32_t)Info.st_dev;
+    Entry.ino = (uint32_t)Info.st_ino;
+    Entry.uid = (uint32_t)Info.st_uid;
+    Entry.gid = (uint32_t)Info.st_gid;
+    Entry.file_size = (uint32_t)Info.st_size;
+#endif
+}
+
+static int RefreshEntry(git_index *Index, const Plan &Current, const std::string &Path)
+{
+    const git_index_entry *Existing = git_index_get_bypath(Index, Path.c_str(), 0);
+
+    if (!Existing)
+        return 0;
+
+    git_index_entry Entry = *Existing;
+
+    FillStat(Entry, std::filesystem::path(Current.Destination) / Path);
+
+    return git_index_add(Index, &Entry);
+}
+
+// Reads the target tree into the index, which keeps the stat data of every unchanged entry, then fills in the
+// written ones. Nothing outside the changed paths is stat'ed, except after an atomic swap: linking a file into the
+// next tree changes its ctime, so every entry is refreshed there.
+static bool UpdateIndex(git_repository *Repository, const Plan &Current)
+{
+    if (!Current.Indexed)
+        return true;
+
+    git_index *Index = nullptr;
+    git_commit *Commit = nullptr;
+    git_tree *Tree = nullptr;
+
+    int Error = git_repository_index(&Index, Repository);
+
+    if (Error == 0)
+        Error = git_index_read(Index, 0);
+
+    if (Error == 0)
+        Error = git_commit_lookup(&Commit, Repository, &Current.Target);
+
+    if (Error == 0)
+        Error = git_commit_tree(&Tree, Commit);
+
+    if (Error == 0)
+        Error = git_index_read_tree(Index, Tree);
+
+    for (size_t Position = 0; Error == 0 && Current.Atomic && Position < git_index_entrycount(Index); ++Position)
+        Error = RefreshEntry(Index, Current, git_index_get_byindex(Index, Position)->path);
+
+    for (size_t Position = 0; Error == 0 && !Current.Atomic && Position < Current.Changes.size(); ++Position)
+        if (!Current.Changes[Position].Staged.empty())
+            Error = RefreshEntry(Index, Current, Current.Changes[Position].Path);
+
+    for (size_t Position = 0; Error == 0 && Position < Current.Unchanged.size(); ++Position)
+        Error = RefreshEntry(Index, Current, Current.Unchanged[Position]);
+
+    if (Error == 0)
+        Error = git_index_write(Index);
+
+    git_tree_free(Tree);
+    git_commit_free(Commit);
+    git_index_free(Index);
+
+    return Error == 0;
+}
+
+static bool WriteInPlace(git_repository *Repository, const Plan &Current)
+{
+    return WriteChanges(Current, Current.Destination) && UpdateIndex(Repository, Current);
+}
+
+// Builds the new tree next to the live one from hard links and the staged files, then exchanges the two. The live
+// directory is left untouched until the exchange, so a failure before it changes nothing. Untracked files come
+// along with the hard links, whichever revision the plan moves to.
+static bool WriteAtomic(git_repository *Repository, const Plan &Current)
+{
+    std::error_code ErrorCode;
+    std::filesystem::path Live(Core::PathKey(Current.Destination));
+    std::filesystem::path Next = Swap::Sibling(Live, "next");
+    std::set<std::string> Skip;
+
+    for (const Change &Entry : Current.Changes)
+        Skip.insert(Entry.Path);
+
+    bool Built = Swap::Link(Live, Next, Skip);
+
+    if (!Built)
+        git_error_set_str(GIT_ERROR_OS, "Failed to build the next working tree");
+    else
+        Built = WriteChanges(Current, Next);
+
+    if (!Built)
+    {
+        std::filesystem::remove_all(Next, ErrorCode);
+        return false;
+    }
+
+    // The repository moves along with the tree, it keeps its path and every open file stays valid.
+    if (std::filesystem::exists(std::filesystem::symlink_status(Live / ".git", ErrorCode)))
+        std::filesystem::rename(Live / ".git", Next / ".git", ErrorCode);
+
+    if (ErrorCode || !Swap::Exchange(Live, Next))
+    {
+        std::filesystem::rename(Next / ".git", Live / ".git", ErrorCode);
+        std::filesystem::remove_all(Next, ErrorCode);
+        git_error_set_str(GIT_ERROR_OS, "Failed to swap in the next working tree");
+
+        return false;
+    }
+
+    // Next now holds the old tree.
+    std::filesystem::remove_all(Next, ErrorCode);
+
+    return UpdateIndex(Repository, Current);
+}
+
+// Hard links the current version of every path the plan replaces or removes into Kept, named after its position in
+// the plan. The links keep the old files alive once the update moved the new ones over them.
+static bool KeepReplaced(const Plan &Current, const std::filesystem::path &Kept)
+{
+    std::error_code ErrorCode;
+
+    if (!std::filesystem::create_directories(Kept, ErrorCode))
+        return false;
+
+    for (size_t Index = 0; Index < Current.Changes.size(); ++Index)
+    {
+        std::filesystem::path File = std::filesystem::path(Current.Destination) / Current.Changes[Index].Path;
+        std::filesystem::path Link = Kept / std::to_string(Index);
+        std::filesystem::file_status Status = std::filesystem::symlink_status(File, ErrorCode);
+
+        if (!std::filesystem::exists(Status) || std::filesystem::is_directory(Status))
+            continue;
+
+        std::filesystem::create_hard_link(File, Link, ErrorCode);
+
+        if (ErrorCode && !Copy::File(File, Link))
+            return false;
+    }
+
+    return true;
+}
+
+// Writes the plan that undoes Current next to the files KeepReplaced kept: a kept file goes back to its path, a
+// path without one was added and is removed. Every line holds the state the path has now, so a later edit is
+// caught like for any prepared update.
+static bool SaveReverse(const Plan &Current, const std::filesystem::path &Kept)
+{
+    std::ofstream Stream(Kept / "plan", std::ios::trunc);
+    std::error_code ErrorCode;
+
+    Stream << git_oid_tostr_s(&Current.Target) << ' ' << git_oid_tostr_s(&Current.Old) << '\n';
+
+    for (size_t Index = 0; Index < Current.Changes.size(); ++Index)
+    {
+        const std::string &Path = Current.Changes[Index].Path;
+        FileState State = Stat(std::filesystem::path(Current.Destination) / Path);
+        bool Restored =
+            std::filesystem::exists(std::filesystem::symlink_status(Kept / std::to_string(Index), ErrorCode));
+
+        Stream << Restored << ' ' << State.Exists << ' ' << State.Size << ' ' << State.Time.time_since_epoch().count()
+               << ' ' << Path << '\n';
+    }
+
+    return (bool)Stream.flush();
+}
+
+GitCodes PrepareRollback(git_repository *Repository, const std::string &Path, const git_oid &Current,
+                         const git_oid &Target, const std::string &BranchRef, bool Atomic)
+{
+    Discard(Path);
+
+    std::ifstream Stream(Rollback(Repository) / "plan");
+    std::string From, To;
+    git_oid FromOid, ToOid;
+
+    if (!(Stream >> From >> To) || git_oid_fromstr(&FromOid, From.c_str()) != 0 ||
+        git_oid_fromstr(&ToOid, To.c_str()) != 0 || !git_oid_equal(&FromOid, &Current) ||
+        !git_oid_equal(&ToOid, &Target))
+        return GitCodes::NOTHING_PREPARED;
+
+    GitSparseOptions Deployment;
+    bool IsDeployment = Sparse::Load(Repository, Deployment);
+
+    Plan Result;
+    Result.Directory = Rollback(Repository).string();
+    Result.Destination = IsDeployment ? Core::PathKey(Path) : std::string(git_repository_workdir(Repository));
+    Result.BranchRef = BranchRef;
+    Result.Old = Current;
+    Result.Target = Target;
+    Result.Atomic = Atomic;
+    Result.Indexed = !IsDeployment;
+
+    bool Restored;
+    long long Time;
+
+    for (Change Entry; Stream >> Restored >> Entry.State.Exists >> Entry.State.Size >> Time && Stream.get() == ' ' &&
+                       std::getline(Stream, Entry.Path);)
+    {
+        std::filesystem::path Staged = std::filesystem::path(Result.Directory) / std::to_string(Result.Changes.size());
+
+        Entry.State.Time = std::filesystem::file_time_type(std::filesystem::file_time_type::duration(Time));
+        Entry.Staged = Restored ? Staged.string() : std::string();
+        Result.Changes.push_back(Entry);
+    }
+
+    if (!Stream.eof())
+        return GitCodes::NOTHING_PREPARED;
+
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Plans[Core::PathKey(Path)] = std::move(Result);
+
+    return GitCodes::PREPARE_SUCCESS;
+}
+
+GitCodes Apply(git_repository *Repository, const std::string &Path, git_oid &Target, std::string &BranchRef)
+{
+    Plan Current;
+
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        auto Iterator = Plans.find(Core::PathKey(Path));
+
+        if (Iterator == Plans.end())
+            return GitCodes::NOTHING_PREPARED;
+
+        Current = std::move(Iterator->second);
+        Plans.erase(Iterator);
+    }
+
+    std::error_code ErrorCode;
+    git_oid Head;
+    // An initial checkout runs right after the clone moved HEAD.
+    bool Changed = !git_oid_is_zero(&Current.Old) && (git_reference_name_to_id(&Head, Repository, "HEAD") != 0 ||
+                                                      !git_oid_equal(&Head, &Current.Old));
+
+    for (size_t Index = 0; !Changed && Index < Current.Changes.size(); ++Index)
+        Changed = !(Stat(std::filesystem::path(Current.Destination) / Current.Changes[Index].Path) ==
+                    Current.Changes[Index].State);
+
+    if (Changed)
+    {
+        std::filesystem::remove_all(Current.Directory, ErrorCode);
+        git_error_set_str(GIT_ERROR_CHECKOUT, "The repository changed since the update was prepared");
+
+        return GitCodes::PREPARED_STATE_CHANGED;
+    }
+
+    // The replaced files are kept for the next rollback, an initial checkout has nothing to go back to.
+    std::filesystem::path Kept = Rollback(Repository), Keeping = Kept;
+    Keeping += ".next";
+    std::filesystem::remove_all(Keeping, ErrorCode);
+
+    bool Keep = !git_oid_is_zero(&Current.Old) && KeepReplaced(Current, Keeping);
+    bool Written = Current.Atomic ? WriteAtomic(Repository, Current) : WriteInPlace(Repository, Current);
+
+    std::filesystem::remove_all(Current.Directory, ErrorCode);
+    std::filesystem::remove_all(Written ? Kept : Keeping, ErrorCode);
+
+    if (!Written)
+        return GitCodes::FAST_FORWARD_FAILED;
+
+    if (Keep && SaveReverse(Current, Keeping))
+        std::filesystem::rename(Keeping, Kept, ErrorCode);
+    else
+        std::filesystem::remove_all(Keeping, ErrorCode);
+
+    Target = Current.Target;
+    BranchRef = Current.BranchRef;
+
+    return GitCodes::FAST_FORWARD_SUCCESS;
+}
+} // namespace Git::Stage
@@ -0,0 +1,27 @@
+#pragma once
+#include "../includes.h"
+#include "../git/git.h"
+
+class GitOperation;
+
+// A prepared update has every file the fast-forward writes already inflated into <git dir>/gmsvgit-stage, so
+// applying it is a rename per changed path plus the index and ref update. Plans only live in memory, except the one
+// undoing the last update, which keeps the files it replaced in <git dir>/gmsvgit-rollback.
+namespace Git::Stage
+{
+// Diffs Old against Target, stages the new blobs and the new index, and checks that every path it will touch is
+// still unmodified. An atomic plan is applied by swapping in a whole new working tree, see Git::Swap.
+GitCodes Prepare(git_repository *Repository, const std::string &Path, const git_oid &Old, const git_oid &Target,
+                 const std::string &BranchRef, bool Atomic, GitOperation &Operation);
+// Moves the staged files into place and returns the commit and branch the caller points HEAD at. Fails with
+// PREPARED_STATE_CHANGED, leaving the files untouched, when HEAD or any touched path changed since Prepare.
+GitCodes Apply(git_repository *Repository, const std::string &Path, git_oid &Target, std::string &BranchRef);
+// Prepares the undo of the last applied update, which moved Target to Current, from the files it replaced. Returns
+// NOTHING_PREPARED when there is none for these revisions, the caller prepares from the trees then.
+GitCodes PrepareRollback(git_repository *Repository, const std::string &Path, const git_oid &Current,
+                         const git_oid &Target, const std::string &BranchRef, bool Atomic);
+// Paths the prepared update writes or removes, relative to the destination.
+std::vector<std::string> Changes(const std::string &Path);
+bool IsPrepared(const std::string &Path);
+void Discard(const std::string &Path);
+} // namespace Git::Stage
@@ -0,0 +1,150 @@
+#include "store.h"
+#include "../git/git.h"
+#include <git2/sys/errors.h>
+
+namespace Git::Store
+{
+std::string Location(git_repository *Repository)
+{
+    git_config *Config = nullptr;
+    git_buf Buffer = GIT_BUF_INIT;
+    std::string Store;
+
+    if (git_repository_config_snapshot(&Config, Repository) == 0 &&
+        git_config_get_string_buf(&Buffer, Config, GIT_STORE_CONFIG) == 0)
+        Store = Buffer.ptr;
+
+    git_buf_dispose(&Buffer);
+    git_config_free(Config);
+
+    return Store;
+}
+
+bool Configure(git_repository *Repository, const std::string &Store)
+{
+    git_config *Config = nullptr;
+    std::error_code ErrorCode;
+
+    if (!Store.empty() && !std::filesystem::create_directories(Store, ErrorCode) && ErrorCode)
+    {
+        git_error_set_str(GIT_ERROR_OS, ("Failed to create '" + Store + "'").c_str());
+        return false;
+    }
+
+    if (git_repository_config(&Config, Repository) != 0)
+        return false;
+
+    int Error = Store.empty() ? git_config_delete_entry(Config, GIT_STORE_CONFIG)
+                              : git_config_set_string(Config, GIT_STORE_CONFIG, Store.c_str());
+
+    git_config_free(Config);
+
+    return Error == 0 || (Store.empty() && Error == GIT_ENOTFOUND);
+}
+
+// Executable files are kept apart from regular ones since every link shares the mode of the stored file.
+static std::filesystem::path Stored(const std::string &Store, const git_oid &Id, bool Executable)
+{
+    std::string Hash = git_oid_tostr_s(&Id);
+
+    return std::filesystem::path(Store) / Hash.substr(0, 2) / (Hash.substr(2) + (Executable ? ".x" : ""));
+}
+
+// Writes the blob next to its final name and renames it there, so other repositories and server instances adding
+// the same blob at the same time never see a partial file.
+static bool Add(git_repository *Repository, const git_oid &Id, const std::filesystem::path &File, bool Executable)
+{
+    git_blob *Blob = nullptr;
+    std::error_code ErrorCode;
+    std::filesystem::path Temporary = File;
+    Temporary += ".tmp" + std::to_string(std::random_device{}());
+
+    if (git_blob_lookup(&Blob, Repository, &Id) != 0)
+        return false;
+
+    std::filesystem::create_directories(File.parent_path(), ErrorCode);
+
+    bool Written = false;
+
+    {
+        std::ofstream Stream(Temporary, std::ios::binary | std::ios::trunc);
+
+        Stream.write((const char *)git_blob_rawcontent(Blob), (std::streamsize)git_blob_rawsize(Blob));
+        Written = Stream.good();
+    }
+
+    git_blob_free(Blob);
+
+    std::filesystem::perms ReadOnly = std::filesystem::perms::owner_read | std::filesystem::perms::group_read |
+                                      std::filesystem::perms::others_read;
+
+    if (Executable)
+        ReadOnly |= std::filesystem::perms::owner_exec | std::filesystem::perms::group_exec |
+                    std::filesystem::perms::others_exec;
+
+    if (Written)
+        std::filesystem::permissions(Temporary, ReadOnly, std::filesystem::perm_options::replace, ErrorCode);
+
+    if (Written && !ErrorCode)
+        std::filesystem::rename(Temporary, File, ErrorCode);
+
+    if (!Written || ErrorCode)
+    {
+        std::filesystem::remove(Temporary, ErrorCode);
+        return false;
+    }
+
+    return true;
+}
+
+bool Link(git_repository *Repository, const std::string &Store, const git_oid &Id, uint32_t Mode,
+          const std::string &Path, const std::string &Staged)
+{
+    git_filter_list *Filters = nullptr;
+    std::error_code ErrorCode;
+    bool Executable = Mode == GIT_FILEMODE_BLOB_EXECUTABLE;
+
+    if (Mode != GIT_FILEMODE_BLOB && !Executable)
+        return false;
+
+    // The store holds raw blobs, a path whose attributes ask for line ending or other conversions needs its own copy.
+    if (git_filter_list_load(&Filters, Repository, nullptr, Path.c_str(), GIT_FILTER_TO_WORKTREE,
+                             GIT_FILTER_DEFAULT) != 0)
+        return false;
+
+    if (Filters)
+    {
+        git_filter_list_free(Filters);
+        return false;
+    }
+
+    std::filesystem::path File = Stored(Store, Id, Executable);
+
+    if (!std::filesystem::exists(File, ErrorCode) && !Add(Repository, Id, File, Executable))
+        return false;
+
+    std::filesystem::create_hard_link(File, Staged, ErrorCode);
+
+    return !ErrorCode;
+}
+
+size_t Prune(const std::string &Store)
+{
+    std::error_code ErrorCode;
+    size_t Removed = 0;
+
+    for (std::filesystem::recursive_directory_iterator Iterator(Store, ErrorCode), End;
+         !ErrorCode && Iterator != End; Iterator.increment(ErrorCode))
+    {
+        std::error_code EntryError;
+
+        if (!Iterator->is_regular_file(EntryError) || Iterator->hard_link_count(EntryError) != 1 || EntryError)
+            continue;
+
+        if (std::filesystem::remove(Iterator->path(), EntryError))
+            Removed++;
+    }
+
+    return Removed;
+}
+} // namespace Git::Store
@@ -0,0 +1,21 @@
+#pragma once
+#include "../includes.h"
+
+// A content-addressed store of inflated blobs, <store>/<first two hex digits>/<rest of the oid>, that working trees
+// hard link their files from. Repositories sharing a store share one copy of every identical file. Store files are
+// read-only, so an edit in place fails instead of changing every tree linked to it.
+namespace Git::Store
+{
+// The store configured for this repository, empty when it has none.
+std::string Location(git_repository *Repository);
+// Sets or, with an empty Store, removes the store of this repository.
+bool Configure(git_repository *Repository, const std::string &Store);
+
+// Hard links Staged to the stored copy of the blob, adding it to the store first. Returns false when the blob cannot
+// come from the store, e.g. when filters apply to Path or the store is on another filesystem, and the caller then
+// writes the file itself.
+bool Link(git_repository *Repository, const std::string &Store, const git_oid &Id, uint32_t Mode,
+          const std::string &Path, const std::string &Staged);
+// Deletes the stored files no working tree links to anymore, returns how many.
+size_t Prune(const std::string &Store);
+} // namespace Git::Store
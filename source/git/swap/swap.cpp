@@ -0,0 +1,71 @@
+#include "swap.h"
+#include "../copy/copy.h"
+
+#ifdef __linux__
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <cerrno>
+
+#ifndef RENAME_EXCHANGE
+#define RENAME_EXCHANGE (1 << 1)
+#endif
+#endif
+
+namespace Git::Swap
+{
+std::filesystem::path Sibling(const std::filesystem::path &Live, const std::string &Suffix)
+{
+    return Live.parent_path() / ("." + Live.filename().string() + ".gmsvgit-" + Suffix);
+}
+
+bool Link(const std::filesystem::path &Live, const std::filesystem::path &Next, const std::set<std::string> &Skip)
+{
+    std::error_code ErrorCode;
+    std::set<std::string> Excluded = Skip;
+
+    Excluded.insert(".git");
+    std::filesystem::remove_all(Next, ErrorCode);
+
+    if (!std::filesystem::create_directory(Next, ErrorCode))
+        return false;
+
+    return Copy::Tree(Live, Next, Excluded, true);
+}
+
+bool Exchange(const std::filesystem::path &First, const std::filesystem::path &Second)
+{
+#if defined(__linux__) && defined(SYS_renameat2)
+    if (syscall(SYS_renameat2, AT_FDCWD, First.c_str(), AT_FDCWD, Second.c_str(), RENAME_EXCHANGE) == 0)
+        return true;
+
+    // Older kernels and some filesystems do not know the flag, anything else is a real failure.
+    if (errno != ENOSYS && errno != EINVAL)
+        return false;
+#endif
+
+    std::error_code ErrorCode;
+    std::filesystem::path Parked = Second;
+    Parked += ".old";
+
+    std::filesystem::remove_all(Parked, ErrorCode);
+    std::filesystem::rename(First, Parked, ErrorCode);
+
+    if (ErrorCode)
+        return false;
+
+    std::filesystem::rename(Second, First, ErrorCode);
+
+    if (ErrorCode)
+    {
+        std::filesystem::rename(Parked, First, ErrorCode);
+        return false;
+    }
+
+    // First already holds the new tree, so a failure here only leaves the old one behind under another name.
+    std::filesystem::rename(Parked, Second, ErrorCode);
+
+    return true;
+}
+} // namespace Git::Swap
@@ -0,0 +1,15 @@
+#pragma once
+#include "../includes.h"
+
+// Atomic deployments build the next working tree next to the live one and exchange the two directories, so a
+// reader sees either the old or the new tree but never a mix of both.
+namespace Git::Swap
+{
+// Hidden directory next to Live, e.g. addons/.x.gmsvgit-next for addons/x.
+std::filesystem::path Sibling(const std::filesystem::path &Live, const std::string &Suffix);
+// Recreates Live in Next with hard links, skipping the top level .git and the relative paths in Skip. Files are
+// copied where the filesystem cannot link them, see Copy::Tree.
+bool Link(const std::filesystem::path &Live, const std::filesystem::path &Next, const std::set<std::string> &Skip);
+// Swaps two directories, atomically with renameat2 on Linux and with two renames elsewhere.
+bool Exchange(const std::filesystem::path &First, const std::filesystem::path &Second);
+} // namespace Git::Swap
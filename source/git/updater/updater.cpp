@@ -0,0 +1,412 @@
+#include "updater.h"
+#include "../core/core.h"
+#include "../logger/logger.h"
+#include "../pool/pool.h"
+#include "../watchdog/watchdog.h"
+#include "../dispatcher/dispatcher.h"
+#include "../functions/functions.h"
+#include "../snapshot/snapshot.h"
+#include "../stage/stage.h"
+
+namespace Git::Updater
+{
+using Clock = std::chrono::steady_clock;
+
+struct Entry
+{
+    std::string Directory;
+    std::string Path;
+    std::string Branch;
+    std::string Origin;
+    GitUpdatePolicy Policy = GitUpdatePolicy::FASTFORWARD;
+    double Interval = 300;
+    Clock::time_point NextCheck;
+    size_t Failures = 0;
+    size_t Generation = 0;
+    bool Pending = false;
+    bool Busy = false;
+    // Set by a webhook push, the next check skips the remote listing and fetches straight away.
+    bool Triggered = false;
+};
+
+static std::mutex Mutex;
+static std::condition_variable Condition;
+static std::map<std::string, Entry> Entries;
+static std::thread Thread;
+static std::mt19937 Generator{std::random_device{}()};
+static size_t Generations = 0;
+static bool Stopping = false;
+
+static Clock::duration ToDuration(double Seconds)
+{
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(Seconds));
+}
+
+// Spreads checks by +-10% so servers started together do not poll together.
+static Clock::duration Jitter(double Seconds)
+{
+    std::uniform_real_distribution<double> Distribution(0.9, 1.1);
+
+    return ToDuration(Seconds * Distribution(Generator));
+}
+
+static void Run(const Entry &Job, bool Apply, GitOperation &Operation, bool &Pending)
+{
+    GitRepository Repository(Job.Path, Operation.Token, &Operation);
+
+    if (!Repository.Valid())
+    {
+        Operation.Result.Code = GitCodes::REPOSITORY_OPEN_FAILED;
+        return;
+    }
+
+    Operation.Result.OldOid = Repository.GetHash();
+    Operation.Result.NewOid = Operation.Result.OldOid;
+
+    std::string Branch = Repository.GetBranch();
+
+    if (!Job.Branch.empty() && Branch != Job.Branch)
+    {
+        Operation.Result.Code = GitCodes::BRANCH_MISMATCH;
+        Operation.Result.Error = "Checked out branch is " + Branch + ", expected " + Job.Branch;
+        return;
+    }
+
+    if (Apply)
+    {
+        GitPullOptions Options;
+        Options.FastForwardOnly = true;
+        Options.SkipFetch = true;
+
+        // Falls back to a regular fast-forward when nothing was staged or the tree changed since.
+        Operation.Result.Code = Stage::IsPrepared(Job.Path) ? Repository.Apply() : GitCodes::NOTHING_PREPARED;
+
+        if (Operation.Result.Code == GitCodes::NOTHING_PREPARED ||
+            Operation.Result.Code == GitCodes::PREPARED_STATE_CHANGED)
+            Operation.Result.Code = Repository.Pull(Options);
+        Operation.Result.NewOid = Repository.GetHash();
+        Functions::TrackChanges(Repository.GetRepository(), Operation);
+        Pending = false;
+        return;
+    }
+
+    std::string RemoteHash;
+    Operation.Result.Code = Job.Triggered ? GitCodes::REMOTE_CHANGED : Repository.CheckRemote(RemoteHash);
+
+    if (Operation.Result.Code != GitCodes::REMOTE_CHANGED)
+    {
+        if (Operation.Result.Code == GitCodes::REMOTE_UP_TO_DATE)
+            Pending = false;
+
+        return;
+    }
+
+    git_oid Tracking;
+    git_buf Upstream = GIT_BUF_INIT;
+    std::string TrackingRef = "refs/remotes/origin/" + Branch;
+
+    // CheckRemote compared against the branch's upstream, so the same one is looked at here.
+    if (git_branch_upstream_name(&Upstream, Repository.GetRepository(), ("refs/heads/" + Branch).c_str()) == 0)
+        TrackingRef = Upstream.ptr;
+
+    git_buf_dispose(&Upstream);
+
+    bool Fetched = git_reference_name_to_id(&Tracking, Repository.GetRepository(), TrackingRef.c_str()) == 0 &&
+                   RemoteHash == git_oid_tostr_s(&Tracking);
+
+    // The remote moved since the last check but we already fetched it, nothing new to download.
+    if (!Job.Triggered && Job.Policy != GitUpdatePolicy::FASTFORWARD && Fetched)
+    {
+        Pending = Job.Policy == GitUpdatePolicy::MAPCHANGE;
+
+        if (Pending && !Stage::IsPrepared(Job.Path))
+            Repository.Prepare(true);
+
+        return;
+    }
+
+    GitPullOptions Options;
+    Options.FetchOnly = Job.Policy != GitUpdatePolicy::FASTFORWARD;
+    Options.FastForwardOnly = true;
+
+    Operation.Result.Code = Repository.Pull(Options);
+    Operation.Result.NewOid = Repository.GetHash();
+    Functions::TrackChanges(Repository.GetRepository(), Operation);
+
+    if (!GitCodeSucceeded(Operation.Result.Code))
+        Operation.Result.Error = Functions::GetLastErrorMessage();
+
+    if (Operation.Result.Code != GitCodes::FETCH_SUCCESS || Job.Policy != GitUpdatePolicy::MAPCHANGE)
+        return;
+
+    Pending = true;
+
+    // Stage the files now so the map change only has to move them into place. A failure here is not fatal, the
+    // shutdown falls back to a regular fast-forward.
+    if (Repository.Prepare(true) != GitCodes::PREPARE_SUCCESS)
+        Logger::Log(Logger::Info("Could not prepare the update of {cyan}%s{white}: {red}%s"), Job.Directory.c_str(),
+                    Functions::GetLastErrorMessage().c_str());
+}
+
+static void Reschedule(const std::string &Key, size_t Generation, bool Succeeded, bool Pending)
+{
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        auto Iterator = Entries.find(Key);
+
+        // Unregistered or registered again while the check was running.
+        if (Iterator == Entries.end() || Iterator->second.Generation != Generation)
+            return;
+
+        Entry &Current = Iterator->second;
+        double Delay = Current.Interval;
+
+        Current.Failures = Succeeded ? 0 : Current.Failures + 1;
+        Current.Pending = Pending;
+        Current.Busy = false;
+
+        if (Current.Failures > 0)
+            Delay = std::min(Current.Interval * (double)(1 << std::min<size_t>(Current.Failures, 6)),
+                             std::max(Current.Interval, 3600.0));
+
+        Current.NextCheck = Current.Triggered ? Clock::now() : Clock::now() + Jitter(Delay);
+    }
+
+    Condition.notify_all();
+}
+
+static void Update(Entry Job, bool Apply)
+{
+    std::shared_ptr<GitOperation> Operation =
+        std::make_shared<GitOperation>(Functions::GetGithubAccessToken(), Dispatcher::NO_CALLBACK);
+    bool Pending = Job.Pending;
+
+    Operation->Start();
+    Watchdog::Watch(Operation);
+    Run(Job, Apply, *Operation, Pending);
+    Watchdog::Unwatch(Operation);
+    Operation->Finish();
+
+    const GitResult &Result = Operation->Result;
+    bool Succeeded = GitCodeSucceeded(Result.Code);
+
+    if (Result.OldOid != Result.NewOid)
+        Functions::RefreshSnapshot(Job.Path, Operation->Touched ? &*Operation->Touched : nullptr);
+
+    if (!Succeeded)
+        Logger::Log(Logger::Error("Auto-update of {cyan}%s{white} failed: {red}%s"), Job.Directory.c_str(),
+                    GitCodeName(Result.Code));
+    else if (Result.Code == GitCodes::FAST_FORWARD_SUCCESS)
+        Logger::Log(Logger::Success("Auto-update fast-forwarded {cyan}%s{white}."), Job.Directory.c_str());
+    else if (Result.Code == GitCodes::FETCH_SUCCESS)
+        Logger::Log(Logger::Info("Auto-update fetched {cyan}%s{white}."), Job.Directory.c_str());
+
+    if (!Succeeded || Result.Code == GitCodes::FAST_FORWARD_SUCCESS || Result.Code == GitCodes::FETCH_SUCCESS)
+    {
+        std::vector<std::string> Arguments = {Job.Directory, GitCodeName(Result.Code), Result.OldOid, Result.NewOid};
+
+        Dispatcher::Post([=](GarrysMod::Lua::ILuaBase *LUA) { Dispatcher::RunHook(LUA, "GitAutoUpdate", Arguments); });
+    }
+
+    if (!Apply)
+        Reschedule(Core::PathKey(Job.Path), Job.Generation, Succeeded, Pending);
+}
+
+static void ScheduleLoop()
+{
+    std::unique_lock<std::mutex> Lock(Mutex);
+
+    while (!Stopping)
+    {
+        Clock::time_point Now = Clock::now();
+        Clock::time_point Wake = Now + std::chrono::hours(1);
+
+        for (auto &[Key, Current] : Entries)
+        {
+            if (Current.Busy)
+                continue;
+
+            if (Current.NextCheck > Now)
+            {
+                Wake = std::min(Wake, Current.NextCheck);
+                continue;
+            }
+
+            // Runs on the repository's lane, so it never overlaps a Lua initiated operation on it.
+            Current.Busy = true;
+            Pool::Submit(Current.Path, [Job = Current]() { Update(Job, false); });
+            Current.Triggered = false;
+        }
+
+        Condition.wait_until(Lock, Wake);
+    }
+}
+
+void Initialize()
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+
+    Stopping = false;
+    Thread = std::thread(ScheduleLoop);
+}
+
+void Shutdown()
+{
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        Stopping = true;
+    }
+
+    Condition.notify_all();
+
+    if (Thread.joinable())
+        Thread.join();
+
+    std::lock_guard<std::mutex> Lock(Mutex);
+
+    // Queued behind any running check; the pool drains them before the map changes.
+    for (const auto &[Key, Current] : Entries)
+    {
+        if (Current.Policy != GitUpdatePolicy::MAPCHANGE || !Current.Pending)
+            continue;
+
+        Logger::Log(Logger::Info("Applying fetched update of {cyan}%s{white}..."), Current.Directory.c_str());
+        Pool::Submit(Current.Path, [Job = Current]() { Update(Job, true); });
+    }
+
+    Entries.clear();
+}
+
+static std::string ReadOrigin(const std::string &Path)
+{
+    GitRepository Repository(Path, std::string());
+    git_remote *Remote = nullptr;
+    std::string URL;
+
+    if (Repository.Valid() && git_remote_lookup(&Remote, Repository.GetRepository(), "origin") == 0 &&
+        git_remote_url(Remote))
+        URL = git_remote_url(Remote);
+
+    git_remote_free(Remote);
+
+    return URL.empty() ? URL : Core::RemoteKey(URL);
+}
+
+void Register(const std::string &Directory, const std::string &Path, double Interval, const std::string &Branch,
+              GitUpdatePolicy Policy)
+{
+    std::string Origin = ReadOrigin(Path);
+
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        Entry &Current = Entries[Core::PathKey(Path)];
+
+        Current.Directory = Directory;
+        Current.Path = Path;
+        Current.Branch = Branch;
+        Current.Origin = Origin;
+        Current.Policy = Policy;
+        Current.Interval = std::max(Interval, 10.0);
+        Current.Failures = 0;
+        Current.Generation = ++Generations;
+        Current.Busy = false;
+        Current.Triggered = false;
+
+        // The first check lands anywhere within one interval to spread out a fleet restart.
+        std::uniform_real_distribution<double> Distribution(0.0, Current.Interval);
+        Current.NextCheck = Clock::now() + ToDuration(Distribution(Generator));
+    }
+
+    Condition.notify_all();
+}
+
+bool Unregister(const std::string &Path)
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+
+    return Entries.erase(Core::PathKey(Path)) > 0;
+}
+
+size_t Trigger(const std::vector<std::string> &URLs, const std::string &Branch)
+{
+    std::set<std::string> Keys;
+    size_t Count = 0;
+
+    std::map<std::string, std::string> Paths, Branches;
+
+    for (const std::string &URL : URLs)
+        Keys.insert(Core::RemoteKey(URL));
+
+    // Entries without a branch follow the checked out one. Snapshots are read without holding Mutex, so this never
+    // waits on a snapshot refresh while the update thread waits on Mutex.
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+
+        for (auto &[Key, Current] : Entries)
+            if (!Current.Origin.empty() && Keys.count(Current.Origin) && Current.Branch.empty())
+                Paths[Key] = Current.Path;
+    }
+
+    for (const auto &[Key, Path] : Paths)
+    {
+        std::shared_ptr<const GitSnapshot> State = Snapshot::Get(Path);
+        Branches[Key] = State ? State->Branch : std::string();
+    }
+
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+
+        for (auto &[Key, Current] : Entries)
+        {
+            if (Current.Origin.empty() || !Keys.count(Current.Origin))
+                continue;
+
+            std::string Expected = Current.Branch;
+
+            if (Expected.empty() && Branches.count(Key))
+                Expected = Branches[Key];
+
+            if (!Expected.empty() && Expected != Branch)
+                continue;
+
+            // A check already running reschedules itself immediately once it finishes.
+            Current.Triggered = true;
+            Current.NextCheck = Clock::now();
+            Count++;
+        }
+    }
+
+    Condition.notify_all();
+
+    return Count;
+}
+
+bool ParsePolicy(const char *Name, GitUpdatePolicy &Policy)
+{
+    static const std::map<std::string, GitUpdatePolicy> Policies = {{"fetch", GitUpdatePolicy::FETCH},
+                                                                    {"fastforward", GitUpdatePolicy::FASTFORWARD},
+                                                                    {"mapchange", GitUpdatePolicy::MAPCHANGE}};
+    auto Iterator = Policies.find(Name);
+
+    if (Iterator == Policies.end())
+        return false;
+
+    Policy = Iterator->second;
+    return true;
+}
+
+const char *PolicyName(GitUpdatePolicy Policy)
+{
+    switch (Policy)
+    {
+    case GitUpdatePolicy::FETCH:
+        return "fetch";
+    case GitUpdatePolicy::FASTFORWARD:
+        return "fastforward";
+    case GitUpdatePolicy::MAPCHANGE:
+        return "mapchange";
+    }
+
+    return "unknown";
+}
+} // namespace Git::Updater
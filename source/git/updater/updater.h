@@ -0,0 +1,25 @@
+#pragma once
+#include "../includes.h"
+
+enum class GitUpdatePolicy
+{
+    FETCH = 0,
+    FASTFORWARD,
+    MAPCHANGE
+};
+
+namespace Git::Updater
+{
+void Initialize();
+// Applies fetched updates of map change repositories before stopping.
+void Shutdown();
+
+void Register(const std::string &Directory, const std::string &Path, double Interval, const std::string &Branch,
+              GitUpdatePolicy Policy);
+bool Unregister(const std::string &Path);
+// Queues an immediate fetch for every registered repository whose origin is one of the URLs.
+size_t Trigger(const std::vector<std::string> &URLs, const std::string &Branch);
+
+bool ParsePolicy(const char *Name, GitUpdatePolicy &Policy);
+const char *PolicyName(GitUpdatePolicy Policy);
+} // namespace Git::Updater
@@ -0,0 +1,110 @@
+#include "watchdog.h"
+#include "../logger/logger.h"
+
+namespace Git::Watchdog
+{
+static std::mutex Mutex;
+static std::condition_variable Condition;
+static std::set<std::shared_ptr<GitOperation>> Operations;
+static std::thread Thread;
+static bool Stopping = false;
+static double ConnectTimeout = 30;
+static double TransferTimeout = 120;
+static double CheckoutTimeout = 300;
+
+static double GetTimeout(GitOperationPhase Phase)
+{
+    switch (Phase)
+    {
+    case GitOperationPhase::CONNECT:
+        return ConnectTimeout;
+    case GitOperationPhase::TRANSFER:
+        return TransferTimeout;
+    case GitOperationPhase::CHECKOUT:
+        return CheckoutTimeout;
+    default:
+        return 0;
+    }
+}
+
+static void WatchLoop()
+{
+    std::unique_lock<std::mutex> Lock(Mutex);
+
+    while (!Stopping)
+    {
+        Condition.wait_for(Lock, std::chrono::milliseconds(250));
+
+        for (const std::shared_ptr<GitOperation> &Operation : Operations)
+        {
+            if (Operation->TimedOut())
+                continue;
+
+            GitOperationPhase Phase = Operation->GetPhase();
+            double Timeout = GetTimeout(Phase);
+
+            if (Timeout <= 0 || Operation->GetIdleSeconds() < Timeout)
+                continue;
+
+            Logger::Log(Logger::Error("Operation stalled for {yellow}%.0f{white}s during {cyan}%s{white}, cancelling."),
+                        Timeout, Operation::PhaseName(Phase));
+
+            Operation->TimeOut();
+        }
+    }
+}
+
+static void ApplyServerTimeouts()
+{
+    // Callbacks never fire while a socket is blocked, so libgit2 has to bound connect and read calls itself.
+    git_libgit2_opts(GIT_OPT_SET_SERVER_CONNECT_TIMEOUT, (int)(ConnectTimeout * 1000));
+    git_libgit2_opts(GIT_OPT_SET_SERVER_TIMEOUT, (int)(TransferTimeout * 1000));
+}
+
+void Initialize()
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+
+    Stopping = false;
+    ApplyServerTimeouts();
+    Thread = std::thread(WatchLoop);
+}
+
+void Shutdown()
+{
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        Stopping = true;
+    }
+
+    Condition.notify_all();
+
+    if (Thread.joinable())
+        Thread.join();
+
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Operations.clear();
+}
+
+void Watch(const std::shared_ptr<GitOperation> &Operation)
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Operations.insert(Operation);
+}
+
+void Unwatch(const std::shared_ptr<GitOperation> &Operation)
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Operations.erase(Operation);
+}
+
+void SetTimeouts(double Connect, double Transfer, double Checkout)
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+
+    ConnectTimeout = std::max(Connect, 0.0);
+    TransferTimeout = std::max(Transfer, 0.0);
+    CheckoutTimeout = std::max(Checkout, 0.0);
+    ApplyServerTimeouts();
+}
+} // namespace Git::Watchdog
@@ -0,0 +1,15 @@
+#pragma once
+#include "../includes.h"
+#include "../operation/operation.h"
+
+namespace Git::Watchdog
+{
+void Initialize();
+void Shutdown();
+
+void Watch(const std::shared_ptr<GitOperation> &Operation);
+void Unwatch(const std::shared_ptr<GitOperation> &Operation);
+
+// Seconds without progress before an operation in that phase is cancelled, 0 disables the limit.
+void SetTimeouts(double Connect, double Transfer, double Checkout);
+} // namespace Git::Watchdog
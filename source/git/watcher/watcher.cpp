@@ -0,0 +1,299 @@
+#include "watcher.h"
+#include "../core/core.h"
+#include "../logger/logger.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+namespace Git::Watcher
+{
+#ifdef __linux__
+struct WatchedDirectory
+{
+    std::string Key;
+    std::string Directory;
+    bool Root;
+};
+
+struct WatchedRepository
+{
+    std::string Path;
+    std::set<int> Descriptors;
+};
+
+static constexpr uint32_t WATCH_MASK =
+    IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_ONLYDIR;
+static constexpr int QUIET_MILLISECONDS = 100;
+
+static std::mutex Mutex;
+static std::map<int, WatchedDirectory> Directories;
+static std::map<std::string, WatchedRepository> Repositories;
+static std::map<std::string, std::chrono::steady_clock::time_point> Pending;
+static std::function<void(const std::string &)> Changed;
+static std::thread Thread;
+static int InotifyDescriptor = -1;
+static int WakeDescriptor = -1;
+static std::atomic<bool> Stopping{false};
+
+static void AddDirectory(const std::string &Key, const std::string &Directory, bool Root)
+{
+    int Descriptor = inotify_add_watch(InotifyDescriptor, Directory.c_str(), WATCH_MASK);
+
+    if (Descriptor < 0)
+        return;
+
+    Directories[Descriptor] = {Key, Directory, Root};
+    Repositories[Key].Descriptors.insert(Descriptor);
+}
+
+static void AddTree(const std::string &Key, const std::string &Directory)
+{
+    std::error_code ErrorCode;
+
+    AddDirectory(Key, Directory, false);
+
+    for (auto Iterator = std::filesystem::recursive_directory_iterator(Directory, ErrorCode);
+         !ErrorCode && Iterator != std::filesystem::recursive_directory_iterator(); Iterator.increment(ErrorCode))
+        if (Iterator->is_directory(ErrorCode))
+            AddDirectory(Key, Iterator->path().string(), false);
+}
+
+static bool IsRelevant(const WatchedDirectory &Watched, const char *Name)
+{
+    std::string File = Name;
+
+    if (File.size() >= 5 && File.compare(File.size() - 5, 5, ".lock") == 0)
+        return false;
+
+    if (Watched.Root)
+        return File == "HEAD" || File == "packed-refs";
+
+    return true;
+}
+
+static void HandleEvents()
+{
+    alignas(struct inotify_event) char Buffer[16384];
+    auto Now = std::chrono::steady_clock::now();
+
+    while (true)
+    {
+        ssize_t Length = read(InotifyDescriptor, Buffer, sizeof(Buffer));
+
+        if (Length <= 0)
+            return;
+
+        std::lock_guard<std::mutex> Lock(Mutex);
+
+        for (char *Cursor = Buffer; Cursor < Buffer + Length;)
+        {
+            const struct inotify_event *Event = (const struct inotify_event *)Cursor;
+            Cursor += sizeof(struct inotify_event) + Event->len;
+
+            if (Event->mask & IN_Q_OVERFLOW)
+            {
+                for (const auto &[Key, Repository] : Repositories)
+                    Pending[Key] = Now;
+
+                continue;
+            }
+
+            auto Iterator = Directories.find(Event->wd);
+
+            if (Iterator == Directories.end())
+                continue;
+
+            WatchedDirectory Watched = Iterator->second;
+
+            if (Event->mask & IN_IGNORED)
+            {
+                auto Repository = Repositories.find(Watched.Key);
+
+                if (Repository != Repositories.end())
+                    Repository->second.Descriptors.erase(Event->wd);
+
+                Directories.erase(Iterator);
+                continue;
+            }
+
+            if (Event->len == 0)
+                continue;
+
+            if ((Event->mask & IN_ISDIR) && (Event->mask & (IN_CREATE | IN_MOVED_TO)) && !Watched.Root)
+                AddTree(Watched.Key, Watched.Directory + "/" + Event->name);
+
+            if (IsRelevant(Watched, Event->name))
+                Pending[Watched.Key] = Now;
+        }
+    }
+}
+
+static void FlushPending()
+{
+    std::vector<std::string> Ready;
+    auto Now = std::chrono::steady_clock::now();
+
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+
+        // Wait for a quiet period so a fetch updating many refs is reported once.
+        for (auto Iterator = Pending.begin(); Iterator != Pending.end();)
+        {
+            if (Now - Iterator->second < std::chrono::milliseconds(QUIET_MILLISECONDS))
+            {
+                ++Iterator;
+                continue;
+            }
+
+            auto Repository = Repositories.find(Iterator->first);
+
+            if (Repository != Repositories.end())
+                Ready.push_back(Repository->second.Path);
+
+            Iterator = Pending.erase(Iterator);
+        }
+    }
+
+    for (const std::string &Path : Ready)
+        Changed(Path);
+}
+
+static void WatchLoop()
+{
+    while (!Stopping.load())
+    {
+        bool HasPending;
+
+        {
+            std::lock_guard<std::mutex> Lock(Mutex);
+            HasPending = !Pending.empty();
+        }
+
+        struct pollfd Descriptors[2] = {{InotifyDescriptor, POLLIN, 0}, {WakeDescriptor, POLLIN, 0}};
+
+        if (poll(Descriptors, 2, HasPending ? QUIET_MILLISECONDS / 2 : -1) < 0 && errno != EINTR)
+            break;
+
+        if (Descriptors[1].revents & POLLIN)
+        {
+            uint64_t Value;
+            (void)read(WakeDescriptor, &Value, sizeof(Value));
+        }
+
+        if (Descriptors[0].revents & POLLIN)
+            HandleEvents();
+
+        FlushPending();
+    }
+}
+
+void Initialize(std::function<void(const std::string &Path)> OnChanged)
+{
+    Changed = std::move(OnChanged);
+    InotifyDescriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    WakeDescriptor = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (InotifyDescriptor < 0 || WakeDescriptor < 0)
+    {
+        Logger::Log(Logger::Error("Failed to initialize inotify, external ref changes will not be detected."));
+        return;
+    }
+
+    Stopping.store(false);
+    Thread = std::thread(WatchLoop);
+}
+
+void Shutdown()
+{
+    Stopping.store(true);
+
+    if (WakeDescriptor >= 0)
+    {
+        uint64_t Value = 1;
+        (void)write(WakeDescriptor, &Value, sizeof(Value));
+    }
+
+    if (Thread.joinable())
+        Thread.join();
+
+    std::lock_guard<std::mutex> Lock(Mutex);
+
+    if (InotifyDescriptor >= 0)
+        close(InotifyDescriptor);
+
+    if (WakeDescriptor >= 0)
+        close(WakeDescriptor);
+
+    InotifyDescriptor = -1;
+    WakeDescriptor = -1;
+    Directories.clear();
+    Repositories.clear();
+    Pending.clear();
+}
+
+void Watch(const std::string &Path, const std::string &GitDirectory)
+{
+    if (InotifyDescriptor < 0)
+        return;
+
+    std::string Key = Core::PathKey(Path);
+    std::lock_guard<std::mutex> Lock(Mutex);
+    auto Iterator = Repositories.find(Key);
+
+    // Watches disappear with their directory, e.g. when a clone replaces the repository.
+    if (Iterator != Repositories.end() && !Iterator->second.Descriptors.empty())
+        return;
+
+    std::string Root = GitDirectory;
+
+    while (Root.size() > 1 && Root.back() == '/')
+        Root.pop_back();
+
+    Repositories[Key].Path = Path;
+    AddDirectory(Key, Root, true);
+    AddTree(Key, Root + "/refs");
+}
+
+void Unwatch(const std::string &Path)
+{
+    if (InotifyDescriptor < 0)
+        return;
+
+    std::string Key = Core::PathKey(Path);
+    std::lock_guard<std::mutex> Lock(Mutex);
+    auto Iterator = Repositories.find(Key);
+
+    if (Iterator == Repositories.end())
+        return;
+
+    for (int Descriptor : Iterator->second.Descriptors)
+    {
+        inotify_rm_watch(InotifyDescriptor, Descriptor);
+        Directories.erase(Descriptor);
+    }
+
+    Repositories.erase(Iterator);
+    Pending.erase(Key);
+}
+#else
+void Initialize(std::function<void(const std::string &Path)>)
+{
+}
+
+void Shutdown()
+{
+}
+
+void Watch(const std::string &, const std::string &)
+{
+}
+
+void Unwatch(const std::string &)
+{
+}
+#endif
+} // namespace Git::Watcher
@@ -0,0 +1,13 @@
+#pragma once
+#include "../includes.h"
+
+// Watches HEAD, packed-refs and refs/ of every repository the module has touched.
+// Only implemented with inotify on Linux; elsewhere Watch is a no-op and snapshots refresh after operations only.
+namespace Git::Watcher
+{
+void Initialize(std::function<void(const std::string &Path)> OnChanged);
+void Shutdown();
+
+void Watch(const std::string &Path, const std::string &GitDirectory);
+void Unwatch(const std::string &Path);
+} // namespace Git::Watcher
@@ -0,0 +1,552 @@
+#include "webhook.h"
+#include "../logger/logger.h"
+#include "../updater/updater.h"
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+namespace Git::Webhook
+{
+#ifdef _WIN32
+using Socket = SOCKET;
+static constexpr Socket INVALID = INVALID_SOCKET;
+
+static void CloseSocket(Socket Handle)
+{
+    closesocket(Handle);
+}
+
+static int PollSocket(Socket Handle, int Milliseconds)
+{
+    WSAPOLLFD Descriptor = {Handle, POLLIN, 0};
+    return WSAPoll(&Descriptor, 1, Milliseconds);
+}
+#else
+using Socket = int;
+static constexpr Socket INVALID = -1;
+
+static void CloseSocket(Socket Handle)
+{
+    close(Handle);
+}
+
+static int PollSocket(Socket Handle, int Milliseconds)
+{
+    pollfd Descriptor = {Handle, POLLIN, 0};
+    return poll(&Descriptor, 1, Milliseconds);
+}
+#endif
+
+static constexpr size_t MAX_HEADER_SIZE = 16 * 1024;
+static constexpr size_t MAX_BODY_SIZE = 4 * 1024 * 1024;
+// Counted from accept for the whole request, the listener serves one client at a time and must not be held by a
+// client trickling bytes in.
+static constexpr int REQUEST_TIMEOUT_MILLISECONDS = 5000;
+
+static std::mutex Mutex;
+static std::thread Thread;
+static std::atomic<bool> Stopping{false};
+static Socket Listener = INVALID;
+static std::string Key;
+
+// SHA-256 (FIPS 180-4), only used to verify webhook signatures.
+class Sha256
+{
+  public:
+    Sha256()
+    {
+        static const uint32_t Initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                            0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+        std::copy(Initial, Initial + 8, State);
+    }
+
+    void Update(const uint8_t *Data, size_t Size)
+    {
+        for (size_t Index = 0; Index < Size; ++Index)
+        {
+            Block[Used++] = Data[Index];
+
+            if (Used == 64)
+            {
+                Transform();
+                Length += 512;
+                Used = 0;
+            }
+        }
+    }
+
+    void Update(const std::string &Data)
+    {
+        Update((const uint8_t *)Data.data(), Data.size());
+    }
+
+    std::string Finish()
+    {
+        uint64_t Bits = Length + (uint64_t)Used * 8;
+        uint8_t Padding = 0x80;
+
+        Update(&Padding, 1);
+        Padding = 0;
+
+        while (Used != 56)
+            Update(&Padding, 1);
+
+        for (int Shift = 56; Shift >= 0; Shift -= 8)
+        {
+            uint8_t Byte = (uint8_t)(Bits >> Shift);
+            Update(&Byte, 1);
+        }
+
+        std::string Digest(32, '\0');
+
+        for (int Index = 0; Index < 32; ++Index)
+            Digest[Index] = (char)(State[Index / 4] >> (24 - (Index % 4) * 8));
+
+        return Digest;
+    }
+
+  private:
+    static uint32_t Rotate(uint32_t Value, int Count)
+    {
+        return (Value >> Count) | (Value << (32 - Count));
+    }
+
+    void Transform()
+    {
+        static const uint32_t Constants[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+        uint32_t Words[64];
+
+        for (int Index = 0; Index < 16; ++Index)
+            Words[Index] = (uint32_t)Block[Index * 4] << 24 | (uint32_t)Block[Index * 4 + 1] << 16 |
+                           (uint32_t)Block[Index * 4 + 2] << 8 | (uint32_t)Block[Index * 4 + 3];
+
+        for (int Index = 16; Index < 64; ++Index)
+        {
+            uint32_t S0 = Rotate(Words[Index - 15], 7) ^ Rotate(Words[Index - 15], 18) ^ (Words[Index - 15] >> 3);
+            uint32_t S1 = Rotate(Words[Index - 2], 17) ^ Rotate(Words[Index - 2], 19) ^ (Words[Index - 2] >> 10);
+
+            Words[Index] = Words[Index - 16] + S0 + Words[Index - 7] + S1;
+        }
+
+        uint32_t A = State[0], B = State[1], C = State[2], D = State[3];
+        uint32_t E = State[4], F = State[5], G = State[6], H = State[7];
+
+        for (int Index = 0; Index < 64; ++Index)
+        {
+            uint32_t S1 = Rotate(E, 6) ^ Rotate(E, 11) ^ Rotate(E, 25);
+            uint32_t Choice = (E & F) ^ (~E & G);
+            uint32_t First = H + S1 + Choice + Constants[Index] + Words[Index];
+            uint32_t S0 = Rotate(A, 2) ^ Rotate(A, 13) ^ Rotate(A, 22);
+            uint32_t Majority = (A & B) ^ (A & C) ^ (B & C);
+            uint32_t Second = S0 + Majority;
+
+            H = G;
+            G = F;
+            F = E;
+            E = D + First;
+            D = C;
+            C = B;
+            B = A;
+            A = First + Second;
+        }
+
+        State[0] += A;
+        State[1] += B;
+        State[2] += C;
+        State[3] += D;
+        State[4] += E;
+        State[5] += F;
+        State[6] += G;
+        State[7] += H;
+    }
+
+    uint32_t State[8];
+    uint8_t Block[64];
+    size_t Used = 0;
+    uint64_t Length = 0;
+};
+
+static std::string HmacSha256(const std::string &Secret, const std::string &Message)
+{
+    std::string BlockKey = Secret;
+
+    if (BlockKey.size() > 64)
+    {
+        Sha256 Hash;
+        Hash.Update(Secret);
+        BlockKey = Hash.Finish();
+    }
+
+    BlockKey.resize(64, '\0');
+
+    std::string Inner(64, '\0'), Outer(64, '\0');
+
+    for (size_t Index = 0; Index < 64; ++Index)
+    {
+        Inner[Index] = (char)(BlockKey[Index] ^ 0x36);
+        Outer[Index] = (char)(BlockKey[Index] ^ 0x5c);
+    }
+
+    Sha256 InnerHash;
+    InnerHash.Update(Inner);
+    InnerHash.Update(Message);
+
+    Sha256 OuterHash;
+    OuterHash.Update(Outer);
+    OuterHash.Update(InnerHash.Finish());
+
+    return OuterHash.Finish();
+}
+
+static std::string ToHex(const std::string &Data)
+{
+    static const char Digits[] = "0123456789abcdef";
+    std::string Hex;
+
+    for (unsigned char Byte : Data)
+    {
+        Hex.push_back(Digits[Byte >> 4]);
+        Hex.push_back(Digits[Byte & 15]);
+    }
+
+    return Hex;
+}
+
+static std::string Lowercase(std::string Text)
+{
+    std::transform(Text.begin(), Text.end(), Text.begin(),
+                   [](unsigned char Character) { return (char)std::tolower(Character); });
+
+    return Text;
+}
+
+// Compares in constant time so the signature cannot be guessed byte by byte.
+static bool SignatureMatches(const std::string &Expected, const std::string &Received)
+{
+    if (Expected.size() != Received.size())
+        return false;
+
+    unsigned char Difference = 0;
+
+    for (size_t Index = 0; Index < Expected.size(); ++Index)
+        Difference |= (unsigned char)(Expected[Index] ^ Received[Index]);
+
+    return Difference == 0;
+}
+
+// Collects every string value stored under Name anywhere in the document. Not a full JSON parser, but push payloads
+// only need a handful of flat string fields.
+static std::vector<std::string> FindStrings(const std::string &Json, const std::string &Name)
+{
+    std::vector<std::string> Values;
+    std::string Needle = "\"" + Name + "\"";
+    size_t Position = 0;
+
+    while ((Position = Json.find(Needle, Position)) != std::string::npos)
+    {
+        Position += Needle.size();
+
+        size_t Cursor = Json.find_first_not_of(" \t\r\n", Position);
+
+        if (Cursor == std::string::npos || Json[Cursor] != ':')
+            continue;
+
+        Cursor = Json.find_first_not_of(" \t\r\n", Cursor + 1);
+
+        if (Cursor == std::string::npos || Json[Cursor] != '"')
+            continue;
+
+        std::string Value;
+
+        for (++Cursor; Cursor < Json.size() && Json[Cursor] != '"'; ++Cursor)
+        {
+            if (Json[Cursor] == '\\' && Cursor + 1 < Json.size())
+                Cursor++;
+
+            Value.push_back(Json[Cursor]);
+        }
+
+        Values.push_back(Value);
+        Position = Cursor;
+    }
+
+    return Values;
+}
+
+static void Respond(Socket Client, int Status, const char *Reason, const std::string &Body)
+{
+    std::string Response = "HTTP/1.1 " + std::to_string(Status) + " " + Reason +
+                           "\r\nContent-Type: text/plain\r\nConnection: close\r\nContent-Length: " +
+                           std::to_string(Body.size()) + "\r\n\r\n" + Body;
+    size_t Sent = 0;
+
+    while (Sent < Response.size())
+    {
+        int Written = (int)send(Client, Response.data() + Sent, (int)(Response.size() - Sent), 0);
+
+        if (Written <= 0)
+            return;
+
+        Sent += (size_t)Written;
+    }
+}
+
+static bool ReadRequest(Socket Client, std::chrono::steady_clock::time_point Deadline,
+                        std::map<std::string, std::string> &Headers, std::string &Method, std::string &Body)
+{
+    std::string Buffer;
+    char Chunk[4096];
+    size_t HeaderEnd = std::string::npos;
+    size_t ContentLength = 0;
+
+    while (HeaderEnd == std::string::npos || Buffer.size() < HeaderEnd + 4 + ContentLength)
+    {
+        int Remaining = (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+                            Deadline - std::chrono::steady_clock::now())
+                            .count();
+
+        if (Stopping.load() || Remaining <= 0 || PollSocket(Client, Remaining) <= 0)
+            return false;
+
+        int Received = (int)recv(Client, Chunk, sizeof(Chunk), 0);
+
+        if (Received <= 0)
+            return false;
+
+        Buffer.append(Chunk, (size_t)Received);
+
+        if (HeaderEnd != std::string::npos)
+            continue;
+
+        HeaderEnd = Buffer.find("\r\n\r\n");
+
+        if (HeaderEnd == std::string::npos)
+        {
+            if (Buffer.size() > MAX_HEADER_SIZE)
+                return false;
+
+            continue;
+        }
+
+        std::istringstream Stream(Buffer.substr(0, HeaderEnd));
+        std::string Line;
+
+        std::getline(Stream, Line);
+        Method = Line.substr(0, Line.find(' '));
+
+        while (std::getline(Stream, Line))
+        {
+            size_t Colon = Line.find(':');
+
+            if (Colon == std::string::npos)
+                continue;
+
+            std::string Value = Line.substr(Colon + 1);
+            size_t First = Value.find_first_not_of(" \t");
+            size_t Last = Value.find_last_not_of(" \t\r");
+
+            Headers[Lowercase(Line.substr(0, Colon))] =
+                First == std::string::npos ? std::string() : Value.substr(First, Last - First + 1);
+        }
+
+        ContentLength = (size_t)std::strtoull(Headers["content-length"].c_str(), nullptr, 10);
+
+        if (ContentLength > MAX_BODY_SIZE)
+            return false;
+    }
+
+    Body = Buffer.substr(HeaderEnd + 4, ContentLength);
+
+    return true;
+}
+
+static void HandleClient(Socket Client, std::chrono::steady_clock::time_point Deadline)
+{
+    std::map<std::string, std::string> Headers;
+    std::string Method, Body;
+
+    if (!ReadRequest(Client, Deadline, Headers, Method, Body))
+    {
+        Respond(Client, 400, "Bad Request", "Malformed request\n");
+        return;
+    }
+
+    if (Method != "POST")
+    {
+        Respond(Client, 405, "Method Not Allowed", "Only POST is accepted\n");
+        return;
+    }
+
+    std::string Signature =
+        Headers.count("x-hub-signature-256") ? Headers["x-hub-signature-256"] : Headers["x-gitea-signature"];
+
+    if (Signature.compare(0, 7, "sha256=") == 0)
+        Signature.erase(0, 7);
+
+    std::string Expected;
+
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        Expected = ToHex(HmacSha256(Key, Body));
+    }
+
+    if (!SignatureMatches(Expected, Lowercase(Signature)))
+    {
+        Logger::Log(Logger::Error("Rejected webhook with an invalid signature."));
+        Respond(Client, 401, "Unauthorized", "Invalid signature\n");
+        return;
+    }
+
+    std::string Event = Headers.count("x-github-event") ? Headers["x-github-event"] : Headers["x-gitea-event"];
+
+    if (Event == "ping")
+    {
+        Respond(Client, 200, "OK", "pong\n");
+        return;
+    }
+
+    if (Event != "push")
+    {
+        Respond(Client, 202, "Accepted", "Ignored event\n");
+        return;
+    }
+
+    std::vector<std::string> References = FindStrings(Body, "ref");
+
+    if (References.empty() || References[0].compare(0, 11, "refs/heads/") != 0)
+    {
+        Respond(Client, 202, "Accepted", "Not a branch push\n");
+        return;
+    }
+
+    std::string Branch = References[0].substr(11);
+    std::vector<std::string> URLs;
+
+    for (const char *Field : {"clone_url", "ssh_url", "html_url", "git_url"})
+        for (const std::string &URL : FindStrings(Body, Field))
+            URLs.push_back(URL);
+
+    size_t Count = Updater::Trigger(URLs, Branch);
+
+    Logger::Log(Logger::Info("Webhook push to {cyan}%s{white} queued {yellow}%zu{white} repositories."), Branch.c_str(),
+                Count);
+    Respond(Client, 202, "Accepted", "Queued " + std::to_string(Count) + " repositories\n");
+}
+
+static void ListenLoop(Socket Server)
+{
+    while (!Stopping.load())
+    {
+        if (PollSocket(Server, 250) <= 0)
+            continue;
+
+        Socket Client = accept(Server, nullptr, nullptr);
+        std::chrono::steady_clock::time_point Deadline =
+            std::chrono::steady_clock::now() + std::chrono::milliseconds(REQUEST_TIMEOUT_MILLISECONDS);
+
+        if (Client == INVALID)
+            continue;
+
+        // Deploy hooks are rare and tiny, handling them one at a time keeps this to a single thread.
+        HandleClient(Client, Deadline);
+        CloseSocket(Client);
+    }
+
+    CloseSocket(Server);
+}
+
+bool Start(unsigned short Port, const std::string &Secret, const std::string &Bind)
+{
+    Stop();
+
+#ifdef _WIN32
+    WSADATA Data;
+
+    if (WSAStartup(MAKEWORD(2, 2), &Data) != 0)
+        return false;
+#endif
+
+    sockaddr_in Address = {};
+    Address.sin_family = AF_INET;
+    Address.sin_port = htons(Port);
+
+    if (inet_pton(AF_INET, Bind.c_str(), &Address.sin_addr) != 1)
+    {
+        Logger::Log(Logger::Error("Invalid webhook bind address {red}%s{white}."), Bind.c_str());
+        return false;
+    }
+
+    Socket Server = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+    if (Server == INVALID)
+    {
+#ifdef _WIN32
+        WSACleanup();
+#endif
+        return false;
+    }
+
+    int Reuse = 1;
+    setsockopt(Server, SOL_SOCKET, SO_REUSEADDR, (const char *)&Reuse, sizeof(Reuse));
+
+    if (bind(Server, (sockaddr *)&Address, sizeof(Address)) != 0 || listen(Server, 8) != 0)
+    {
+        Logger::Log(Logger::Error("Failed to listen for webhooks on {red}%s:%u{white}."), Bind.c_str(), Port);
+        CloseSocket(Server);
+#ifdef _WIN32
+        WSACleanup();
+#endif
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        Key = Secret;
+        Listener = Server;
+    }
+
+    Stopping.store(false);
+    Thread = std::thread(ListenLoop, Server);
+
+    Logger::Log(Logger::Success("Listening for webhooks on {cyan}%s:%u{white}."), Bind.c_str(), Port);
+
+    return true;
+}
+
+void Stop()
+{
+    if (!Thread.joinable())
+        return;
+
+    Stopping.store(true);
+    Thread.join();
+
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Listener = INVALID;
+    Key.clear();
+
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+bool Running()
+{
+    std::lock_guard<std::mutex> Lock(Mutex);
+    return Listener != INVALID;
+}
+} // namespace Git::Webhook
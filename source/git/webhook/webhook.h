@@ -0,0 +1,10 @@
+#pragma once
+#include "../includes.h"
+
+// Minimal HTTP listener for GitHub and Gitea push webhooks.
+namespace Git::Webhook
+{
+bool Start(unsigned short Port, const std::string &Secret, const std::string &Bind);
+void Stop();
+bool Running();
+} // namespace Git::Webhook